@@ -0,0 +1,57 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "BandTransport.h"
+
+// Offline rendering split by rows over worker processes: each worker loads
+// the scene itself and draws its band with ZBufferScanLine straight into the
+// framebuffer of the transport. Bands are rebalanced after every frame so
+// they all take the time of the slowest band of an even split
+class BandRenderer {
+public:
+
+    struct Settings {
+        int preset  = 0; // Scene, see ResourceManager::loadPreset
+        int workers = 4; // Processes
+        int frames  = 8; // Camera orbits the scene over the frames
+        int width   = 1920;
+        int height  = 1080;
+        int samples = 2;
+    };
+
+    explicit BandRenderer(const Settings& settings);
+
+    // Coordinator: spawn the workers from this executable, render every
+    // frame and write the last one to output as PPM
+    bool render(const std::string& executable,
+                const std::string& output);
+
+    // Worker process started by render, arguments as written there
+    static int runWorker(int    argc,
+                         char** argv);
+
+private:
+
+    // Split the rows so that each band costs the same, assuming the cost of
+    // every row is the average of its band in the last frame
+    void balanceBands(const std::vector<BandResult>& results);
+
+    bool spawnWorkers(const std::string& executable,
+                      const std::string& name);
+
+    void joinWorkers();
+
+private:
+
+    Settings settings_;
+    std::vector<int>bottom_; // Rows of each band
+    std::vector<int>top_;
+
+#ifdef _WIN32
+    std::vector<void *>processes_;
+#else
+    std::vector<int>processes_;
+#endif
+};
@@ -0,0 +1,135 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <GL/glew.h>
+
+#include <atomic>
+#include <string>
+#include <vector>
+
+#include "Lighting.h"
+
+static const int MAX_BAND_WORKERS = 64;
+static const int MAX_BAND_LIGHTS  = 8;
+
+// Everything a worker needs to draw its band of one frame, the scene itself
+// is loaded by every worker
+struct BandFrame {
+    int       sequence = 0;
+    glm::mat4 viewProjection;
+    glm::vec3 eye;
+    glm::vec3 viewDir;
+    int       lightCount = 0;
+    Light     lights[MAX_BAND_LIGHTS];
+    int       bottom[MAX_BAND_WORKERS]; // Output rows [bottom, top] of each worker
+    int       top[MAX_BAND_WORKERS];
+};
+
+struct BandResult {
+    int   worker            = 0;
+    int   bottom            = 0;
+    int   top               = -1;
+    float milliseconds      = 0.0f; // From receiving the frame to the band drawn
+    float setupMilliseconds = 0.0f; // Part of it spent on the scene graph and insertion
+};
+
+// Moves frames from the coordinator to its worker processes and bands back.
+// Workers always draw into getFramebuffer(): a transport sharing memory has
+// nothing more to do, one over sockets would send the rows of the band with
+// the result and assemble them on the coordinator side
+class BandTransport {
+public:
+
+    virtual ~BandTransport()
+    {}
+
+    // Whole output, BGRA rows from the bottom
+    virtual GLubyte* getFramebuffer() = 0;
+
+    // Coordinator: hand the next frame to every worker
+    virtual void publishFrame(const BandFrame& frame) = 0;
+
+    // Coordinator: wait until every worker drew its band, false if one
+    // stopped answering
+    virtual bool collectResults(std::vector<BandResult>& results) = 0;
+
+    // Coordinator: let the workers return
+    virtual void shutdown() = 0;
+
+    // Worker: wait for a frame newer than the last one, false to quit
+    virtual bool receiveFrame(BandFrame& frame) = 0;
+
+    // Worker: the band of the last frame is in the framebuffer
+    virtual void submitResult(const BandResult& result) = 0;
+};
+
+// One shared memory segment on this machine: a header to exchange frames
+// and results, followed by the framebuffer the workers draw into in place
+class SharedMemoryTransport : public BandTransport {
+public:
+
+    ~SharedMemoryTransport();
+
+    // Coordinator side, nullptr when the segment cannot be created
+    static SharedMemoryTransport* create(const std::string& name,
+                                         int                workers,
+                                         int                width,
+                                         int                height);
+
+    // Worker side, same arguments as the coordinator
+    static SharedMemoryTransport* attach(const std::string& name,
+                                         int                worker,
+                                         int                workers,
+                                         int                width,
+                                         int                height);
+
+    GLubyte* getFramebuffer() override
+    {
+        return framebuffer_;
+    }
+
+    void publishFrame(const BandFrame& frame) override;
+
+    bool collectResults(std::vector<BandResult>& results) override;
+
+    void shutdown() override;
+
+    bool receiveFrame(BandFrame& frame) override;
+
+    void submitResult(const BandResult& result) override;
+
+private:
+
+    struct SharedHeader {
+        std::atomic<int> sequence; // Last frame published, -1 asks to quit
+        std::atomic<int> finished; // Workers done with it
+        BandFrame        frame;
+        BandResult       results[MAX_BAND_WORKERS];
+    };
+
+    SharedMemoryTransport(const std::string& name,
+                          int                worker,
+                          int                workers,
+                          int                width,
+                          int                height);
+
+    // Map the segment, creating it on the coordinator side
+    bool open(bool create);
+
+    static size_t getHeaderSize();
+
+private:
+
+    std::string name_;
+    int worker_;  // -1 on the coordinator
+    int workers_;
+    int width_;
+    int height_;
+    size_t size_ = 0;
+    int lastSequence_ = 0;
+
+    void* handle_ = nullptr; // Mapping object on Windows
+    void* memory_ = nullptr;
+    SharedHeader* header_ = nullptr;
+    GLubyte* framebuffer_ = nullptr;
+};
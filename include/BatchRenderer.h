@@ -0,0 +1,79 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <GL/glew.h>
+
+#include <vector>
+
+#include "Lighting.h"
+#include "SceneGraph.h"
+
+class ZBufferScanLine;
+
+// One view of a batch: camera, output size and the image drawn for it
+struct BatchView {
+    glm::mat4 view;
+    glm::mat4 projection;
+    int       width   = 256;
+    int       height  = 256;
+    int       samples = 1;
+    std::vector<GLubyte>image; // BGRA rows from the bottom, filled by render
+};
+
+// Many views of one loaded scene, for turntables and thumbnails. Meshes,
+// textures and object space data are set up once and shared, every worker
+// of the task scheduler draws whole views with its own ZBufferScanLine.
+// With fewer views than workers, views are split into bands of rows
+class BatchRenderer {
+public:
+
+    BatchRenderer(SceneGraph& scene,
+                  float       near = 0.1f,
+                  float       far  = 100.0f);
+
+    ~BatchRenderer();
+
+    void setLights(const std::vector<Light>& lights)
+    {
+        lights_ = lights;
+    }
+
+    // Draw every view, in parallel. The scene must not change meanwhile.
+    // A single view is drawn in bands by all workers
+    void render(std::vector<BatchView>& views);
+
+    // Throughput of the last render
+    float getViewsPerSecond() const
+    {
+        return viewsPerSecond_;
+    }
+
+    // Cameras going once around the scene, framed as in the window
+    std::vector<BatchView> makeTurntable(int   count,
+                                         int   width,
+                                         int   height,
+                                         int   samples   = 1,
+                                         float elevation = 0.0f) const;
+
+private:
+
+    // Rows [bottom, top] of the view, the others stay as they are
+    void renderView(BatchView               & view,
+                    ZBufferScanLine         & context,
+                    std::vector<SceneNode *>& visible,
+                    int                       bottom,
+                    int                       top);
+
+private:
+
+    SceneGraph& scene_;
+    float near_;
+    float far_;
+    std::vector<Light>lights_;
+
+    // Per scheduler slot, a slot draws one view at a time
+    std::vector<ZBufferScanLine *>contexts_;
+    std::vector<std::vector<SceneNode *> >visible_;
+
+    float viewsPerSecond_ = 0.0f;
+};
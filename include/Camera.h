@@ -57,6 +57,12 @@ public:
            glm::vec3 up     = glm::vec3(0.0f, 1.0f, 0.0f)
            );
 
+    // Track ball camera index of count going once around the scene, from
+    // where the window starts
+    static Camera turntable(int     index,
+                            int     count,
+                            GLfloat angleV = 0.0f);
+
     void setPosition(const glm::vec3& position)
     {
         this->position_ = position;
@@ -104,6 +110,11 @@ public:
         return front_;
     }
 
+    const glm::vec3& getPosition()
+    {
+        return position_;
+    }
+
     CameraMode getMode()
     {
         return this->mode_;
@@ -5,25 +5,48 @@
 
 #include <vector>
 
-inline void colorDiv(unsigned char dst[3], int num)
-{
-    dst[2] = dst[2] / num; // R -> B
-    dst[1] = dst[1] / num; // G -> G
-    dst[0] = dst[0] / num; // B -> R
-}
+// A 32-bit BGRA pixel, blue in the lowest byte (matches GL_BGRA with GL_UNSIGNED_INT_8_8_8_8_REV)
+typedef unsigned int Pixel;
 
-inline void colorAdd(unsigned char dst[3], const unsigned char src[3])
+static const Pixel PIXEL_OPAQUE = 0xff000000u;
+
+// Pack an RGBA color into a BGRA word
+inline Pixel packPixel(const unsigned char rgba[4])
 {
-    dst[2] += src[0]; // R -> B
-    dst[1] += src[1]; // G -> G
-    dst[0] += src[2]; // B -> R
+    return static_cast<Pixel>(rgba[2]) | (static_cast<Pixel>(rgba[1]) << 8) |
+           (static_cast<Pixel>(rgba[0]) << 16) | (static_cast<Pixel>(rgba[3]) << 24);
 }
 
-inline void colorMix(unsigned char dst[3], const unsigned char src[3], float scale)
+// Sums pixels in two words of 16-bit lanes (B, R and G, A), exact up to 257 pixels
+struct PixelSum {
+    unsigned int evens = 0;
+    unsigned int odds  = 0;
+
+    void add(Pixel pixel)
+    {
+        evens += pixel & 0x00ff00ffu;
+        odds  += (pixel >> 8) & 0x00ff00ffu;
+    }
+
+    Pixel average(unsigned int count) const
+    {
+        unsigned int b = (evens & 0xffffu) / count;
+        unsigned int r = (evens >> 16) / count;
+        unsigned int g = (odds & 0xffffu) / count;
+        unsigned int a = (odds >> 16) / count;
+
+        return b | (g << 8) | (r << 16) | (a << 24);
+    }
+};
+
+// Blend two pixels with weight / 256 of the second, two channels per multiply
+inline Pixel lerpPixel(Pixel a, Pixel b, unsigned int weight)
 {
-    dst[2] += static_cast<unsigned int>(src[0] * scale); // R -> B
-    dst[1] += static_cast<unsigned int>(src[1] * scale); // G -> G
-    dst[0] += static_cast<unsigned int>(src[2] * scale); // B -> R
+    unsigned int inverse = 256 - weight;
+    unsigned int evens   = ((a & 0x00ff00ffu) * inverse + (b & 0x00ff00ffu) * weight) >> 8;
+    unsigned int odds    = ((a >> 8) & 0x00ff00ffu) * inverse + ((b >> 8) & 0x00ff00ffu) * weight;
+
+    return (evens & 0x00ff00ffu) | (odds & 0xff00ff00u);
 }
 
 inline void colorCpy(unsigned char* dst, const unsigned char* src, bool flip = false, bool alpha = false)
@@ -47,31 +70,6 @@ inline void colorCpy(unsigned char* dst, const unsigned char* src, bool flip = f
     }
 }
 
-inline void colorCpy(unsigned char      * dst,
-                     const unsigned char* src,
-                     const glm::vec3    & scale,
-                     bool                 flip  = false,
-                     bool                 alpha = false)
-{
-    if (flip)
-    {
-        dst[2] = static_cast<unsigned int>(scale.r * src[0]); // R -> B
-        dst[1] = static_cast<unsigned int>(scale.g * src[1]); // G -> G
-        dst[0] = static_cast<unsigned int>(scale.b * src[2]); // B -> R
-    }
-    else
-    {
-        dst[0] = static_cast<unsigned int>(scale.r * src[0]); // R -> R
-        dst[1] = static_cast<unsigned int>(scale.g * src[1]); // G -> G
-        dst[2] = static_cast<unsigned int>(scale.b * src[2]); // B -> B
-    }
-
-    if (alpha)
-    {
-        dst[3] = src[3]; // Alpha
-    }
-}
-
 inline glm::vec4 colorToVec(unsigned char src[4])
 {
     return glm::vec4(src[0], src[1], src[2], src[3]);
@@ -117,6 +115,7 @@ struct Vertice {
     unsigned char color[4] = { 0, 0, 0, 255 };
     glm::vec3     position;
     glm::vec2     texCoord;
+    glm::vec3     normal = glm::vec3(0.0f); // Zero when the mesh has none
 };
 
 struct Face {
@@ -124,26 +123,38 @@ struct Face {
         vertices(vertices)
     {}
 
-    std::vector<Vertice *>vertices;
-    std::vector<int>      indices;
+    const std::vector<Vertice *>& vertices; // Owned by the geometry
+    std::vector<int>              indices;
+    glm::vec4                     plane;    // Object space, see GeometryResource::computeFacePlanes
 };
 
 struct Texture {
+    // Takes the image and converts it to BGRA words
     Texture(unsigned char* image, int width, int height, int channel               = 4, int type= 0) :
-        image(image), height(height), width(width), channel(channel)
+        height(height), width(width), channel(channel)
     {
-        size = height * width * channel;
+        pixels = new Pixel[width * height];
+
+        for (int i = 0; i < width * height; i++)
+        {
+            const unsigned char* src = image + i * channel;
+            unsigned char rgba[4]    = { src[0], src[channel > 1 ? 1 : 0], src[channel > 2 ? 2 : 0],
+                                         static_cast<unsigned char>(channel > 3 ? src[3] : 255) };
+
+            pixels[i] = packPixel(rgba);
+        }
+
+        SOIL_free_image_data(image);
     }
 
     ~Texture()
     {
-        SOIL_free_image_data(image);
+        delete[] pixels;
     }
 
-    unsigned char* image;
-    int            width;
-    int            height;
-    int            channel;
-    int            size;
+    Pixel* pixels;
+    int    width;
+    int    height;
+    int    channel; // Channels of the source image
 };
 }
@@ -3,8 +3,60 @@
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 
+#include <cstdint>
+
+// SSE2 is part of every x64 target
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64)
+# include <emmintrin.h>
+# define USE_SSE2
+#endif
+
 static const float FLT_EPS = 1e-3f;
 
+// Non-temporal fill for output that is not read back (call _mm_sfence before handing it over)
+inline void streamFill(unsigned int* dst, int count, unsigned int value)
+{
+#ifdef USE_SSE2
+    for (; (count > 0) && (reinterpret_cast<uintptr_t>(dst) & 15); count--)
+    {
+        *dst++ = value;
+    }
+
+    __m128i values = _mm_set1_epi32(static_cast<int>(value));
+
+    for (; count >= 4; count -= 4, dst += 4)
+    {
+        _mm_stream_si128(reinterpret_cast<__m128i *>(dst), values);
+    }
+#endif
+
+    for (; count > 0; count--)
+    {
+        *dst++ = value;
+    }
+}
+
+// Non-temporal copy, same rules as streamFill
+inline void streamCopy(unsigned int* dst, const unsigned int* src, int count)
+{
+#ifdef USE_SSE2
+    for (; (count > 0) && (reinterpret_cast<uintptr_t>(dst) & 15); count--)
+    {
+        *dst++ = *src++;
+    }
+
+    for (; count >= 4; count -= 4, dst += 4, src += 4)
+    {
+        _mm_stream_si128(reinterpret_cast<__m128i *>(dst), _mm_loadu_si128(reinterpret_cast<const __m128i *>(src)));
+    }
+#endif
+
+    for (; count > 0; count--)
+    {
+        *dst++ = *src++;
+    }
+}
+
 inline glm::vec3 computeNormal(glm::vec3 const& a, glm::vec3 const& b, glm::vec3 const& c)
 {
     return glm::normalize(glm::cross(c - b, a - b));
@@ -25,6 +77,15 @@ inline float computeZ(glm::vec4 const& plane, float x, float y)
     return -(plane.x * x + plane.y * y + plane.w) / plane.z;
 }
 
+// Plane a(x, y) = x * plane.x + y * plane.y + plane.z through three screen points
+inline glm::vec3 computeScreenPlane(const glm::vec3* p, float a0, float a1, float a2, float det)
+{
+    float ax = ((a1 - a0) * (p[2].y - p[0].y) - (a2 - a0) * (p[1].y - p[0].y)) / det;
+    float ay = ((a2 - a0) * (p[1].x - p[0].x) - (a1 - a0) * (p[2].x - p[0].x)) / det;
+
+    return glm::vec3(ax, ay, a0 - ax * p[0].x - ay * p[0].y);
+}
+
 inline float computeY(glm::vec4 const& plane, float x, float z)
 {
     if (abs(plane.y) < FLT_EPS)
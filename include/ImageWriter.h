@@ -0,0 +1,40 @@
+#pragma once
+
+#include <GL/glew.h>
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+// BGRA rows from the bottom, as the rasterizers draw them, to a binary PPM
+inline bool writeImagePPM(const std::string& path, const GLubyte* image, int width, int height)
+{
+    FILE* file = fopen(path.c_str(), "wb");
+
+    if (file == nullptr)
+    {
+        return false;
+    }
+
+    fprintf(file, "P6 %d %d 255\n", width, height);
+
+    std::vector<unsigned char> row(width * 3);
+
+    for (int y = height - 1; y >= 0; y--)
+    {
+        const GLubyte* pixel = image + y * width * 4;
+
+        for (int x = 0; x < width; x++, pixel += 4)
+        {
+            row[x * 3 + 0] = pixel[2];
+            row[x * 3 + 1] = pixel[1];
+            row[x * 3 + 2] = pixel[0];
+        }
+
+        fwrite(row.data(), 1, row.size(), file);
+    }
+
+    fclose(file);
+
+    return true;
+}
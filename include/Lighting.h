@@ -0,0 +1,81 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <GL/glew.h>
+
+#include <vector>
+using namespace std;
+
+enum LightType {
+    DIRECTIONAL_LIGHT,
+    POINT_LIGHT
+};
+
+struct Light {
+    LightType type;
+    glm::vec3 position;    // Direction the light travels for directional lights
+    glm::vec3 color;       // RGB intensity
+    float     attenuation; // Point lights fall off with 1 / (1 + attenuation * d^2)
+};
+
+// Key light and a warm point light, the lights of every scene for now
+inline vector<Light> getDefaultLights()
+{
+    return {
+        { DIRECTIONAL_LIGHT, glm::vec3(-1.0f, -2.0f, -1.5f), glm::vec3(0.8f, 0.8f, 0.75f), 0.0f  },
+        { POINT_LIGHT,       glm::vec3(3.0f, 3.0f, 4.0f),    glm::vec3(0.5f, 0.45f, 0.4f), 0.02f }
+    };
+}
+
+// World space surface of one scanline, one array per component
+struct GBufferLine {
+    void resize(int width);
+
+    vector<float>normalX;
+    vector<float>normalY;
+    vector<float>normalZ;
+    vector<float>positionX;
+    vector<float>positionY;
+    vector<float>positionZ;
+    vector<unsigned int>covered; // All bits set where a polygon was drawn
+};
+
+// Blinn-Phong over whole G-buffer lines, four pixels at a time
+class LightingPass {
+public:
+
+    void setLights(const vector<Light>& lights)
+    {
+        lights_ = lights;
+    }
+
+    void setEyePosition(const glm::vec3& eye)
+    {
+        eye_ = eye;
+    }
+
+    void setAmbient(float ambient)
+    {
+        ambient_ = ambient;
+    }
+
+    // Light pixels [begin, end) of a line of BGRA albedo in place, background pixels are kept
+    void shadeLine(GLubyte          * color,
+                   const GBufferLine& gBuffer,
+                   int                begin,
+                   int                end);
+
+private:
+
+    void shadePixel(GLubyte          * color,
+                    const GBufferLine& gBuffer,
+                    int                x);
+
+private:
+
+    vector<Light>lights_;
+    glm::vec3 eye_;
+    float ambient_   = 0.25f;
+    float specular_  = 0.4f;
+    float shininess_ = 32.0f;
+};
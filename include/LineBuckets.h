@@ -0,0 +1,86 @@
+#pragma once
+
+#include <utility>
+#include <vector>
+using namespace std;
+
+// Items bucketed by scanline in compressed sparse row form: items are
+// appended in any order, then build() counts them per line, prefix sums the
+// counts into offsets and scatters them into one contiguous array. All
+// storage is reused across frames.
+template<class T>
+class LineBuckets {
+public:
+
+    void add(int line, const T& item)
+    {
+        entries_.emplace_back(line, item);
+    }
+
+    // Bucket everything added so far, keeping insertion order within a line
+    void build(int lines)
+    {
+        offsets_.assign(lines + 1, 0);
+
+        for (auto& entry : entries_)
+        {
+            offsets_[entry.first + 1]++;
+        }
+
+        for (int i = 0; i < lines; i++)
+        {
+            offsets_[i + 1] += offsets_[i];
+        }
+
+        cursors_.assign(offsets_.begin(), offsets_.end() - 1);
+        items_.resize(entries_.size());
+
+        for (auto& entry : entries_)
+        {
+            items_[cursors_[entry.first]++] = entry.second;
+        }
+
+        built_ = true;
+    }
+
+    void clear()
+    {
+        entries_.clear();
+        built_ = false;
+    }
+
+    bool built() const
+    {
+        return built_;
+    }
+
+    // Added items, in insertion order
+    const vector<pair<int, T> >& entries() const
+    {
+        return entries_;
+    }
+
+    // Items of one line, valid after build()
+    const T* begin(int line) const
+    {
+        return items_.data() + offsets_[line];
+    }
+
+    const T* end(int line) const
+    {
+        return items_.data() + offsets_[line + 1];
+    }
+
+    bool empty(int line) const
+    {
+        return offsets_[line] == offsets_[line + 1];
+    }
+
+private:
+
+    vector<pair<int, T> >entries_;
+    vector<int>offsets_; // Start of each line in items_, plus the total
+    vector<int>cursors_;
+    vector<T>items_;
+    bool built_ = false;
+};
@@ -4,15 +4,59 @@
 
 #include <GLFW/glfw3.h>
 
+#include <algorithm>
+#include <deque>
 #include <iostream>
 #include <vector>
 
 #include "ResourceManager.h"
+#include "ResolutionGovernor.h"
 #include "Camera.h"
+#include "SceneGraph.h"
+#include "Lighting.h"
+#include "TaskScheduler.h"
 
+class Rasterizer;
 class ZBufferScanLine;
+struct InterlaceHistory;
+class TileRasterizer;
 class Shader;
 
+// One geometry of the scene as prepareScene submits it, kept so more
+// rasterizers can insert the same frame
+struct SceneDraw {
+    glm::mat4         mvp;
+    glm::mat4         model;
+    GeometryResource* geometry;
+    bool              useTexture;
+};
+
+// One frame in the pipeline: its own rasterizers, so their polygon tables
+// can be filled while other frames rasterize, and the image they draw into
+struct FrameContext {
+    ZBufferScanLine* scanLine       = nullptr;
+    TileRasterizer * tileRasterizer = nullptr;
+    Rasterizer     * rasterizer     = nullptr; // Backend of the frame
+    GLubyte        * image          = nullptr;
+    TaskGroup        raster;
+    int              width   = 0;     // Render size of the frame
+    int              height  = 0;
+    bool             partial = false; // Only rect was redrawn
+    glm::ivec4       rect;
+    int              pass = -1; // Refinement pass summed into the image when presented
+
+    // Scanline bands insert the scene themselves, with the camera of the frame
+    bool                  banded = false;
+    std::vector<SceneDraw>draws;
+    glm::vec3             viewDir;
+    glm::vec3             eye;
+    glm::mat4             viewProjection;
+
+    // For the status line
+    int   polygons     = 0;
+    float lightingTime = 0.0f;
+};
+
 class MainWindow {
 public:
 
@@ -35,10 +79,63 @@ public:
     // Render process
     void        prepareScene();
 
-    void        renderScene(GLubyte* buffer);
+    GeometryResource* selectLod(SceneNode       * node,
+                                int               index,
+                                const glm::mat4 & modelView);
+
+    // Insert the draws recorded by prepareScene
+    void        submitScene(Rasterizer                  & target,
+                            const std::vector<SceneDraw>& draws);
+
+    // Runs as a task, only touches the frame context
+    void        renderScene(FrameContext& frame);
+
+    // Rows [bottom, top] and columns [left, right] of the scanline frame,
+    // drawn with a context of its own
+    void        drawBand(FrameContext   & frame,
+                         ZBufferScanLine& band,
+                         int              left,
+                         int              bottom,
+                         int              right,
+                         int              top);
 
+    // Output pixels (left, bottom, right, top) of screen bounds from the scene graph
+    glm::ivec4  screenRect(const glm::vec4& bounds);
+
+    // Set up the next frame while the previous ones rasterize, and hand the
+    // oldest one to the PBO once the pipeline is full
     void        drawToPBO();
 
+    // Wait for the oldest frame in flight and copy it into the PBO
+    void        presentFrame();
+
+    void        finishFrames();
+
+    // Make a frame context current and bring it up to the current settings
+    void        bindFrame(FrameContext& frame);
+
+    void        createFrames();
+
+    void        destroyFrames();
+
+    // Texture <- PBO, which holds the frame drawn last
+    void        uploadTexture();
+
+    void        updateResolution(float frameTime);
+
+    // Choose the quality of the next frame from camera activity.
+    // Return false if the last frame is already final and still valid
+    bool        refineFrame();
+
+    // Add a refinement pass to the sum and leave the average in its image
+    void        accumulateFrame(FrameContext& frame);
+
+    void        setRenderSize(float scale,
+                              int   samples);
+
+    // Toggle between the scanline and the tile backend
+    void        switchBackend();
+
     void        drawToScreen();
 
     void        renderQuad();
@@ -70,6 +167,21 @@ public:
         showModel_ = mode;
     }
 
+    // Frames in flight, 1 draws every frame before setting up the next
+    void setPipelineDepth(int depth)
+    {
+        destroyFrames();
+        pipelineDepth_ = std::max(depth, 1);
+        createFrames();
+    }
+
+    // Worker threads shared by loading and rendering, call before init
+    void setWorkers(int  workers,
+                    bool pinThreads)
+    {
+        TaskScheduler::shared().configure(workers, pinThreads);
+    }
+
     // Error handle
     void catchGLError(std::string info = "")
     {
@@ -94,6 +206,7 @@ private:
     static bool leftPushed_;
     static bool rightPushed_;
     static bool isRendering_;
+    static bool redraw_; // Settings changed, the image is stale even if the camera is not
     static int showModel_;
 
     // Frame
@@ -107,25 +220,92 @@ private:
     Shader* screenShader_;
     GLuint screenTexture_;
 
-    // TODO: I used double PBO here, but it won't benefit unless there's a seperate render thread
     GLuint PBOs_[2];
-    GLubyte* textureImages_[2];
 
-    // Custom pipeline
+    // Custom pipeline, the rasterizers of the frame being set up
     ZBufferScanLine* scanLine_;
+    TileRasterizer* tileRasterizer_;
+    Rasterizer* rasterizer_; // Active backend
+
+    // Frame pipeline: setup of the next frame overlaps the raster of the
+    // frames before, which reach the screen pipelineDepth_ - 1 frames later
+    int pipelineDepth_ = 2;
+    std::vector<FrameContext *>frames_;
+    int nextFrame_ = 0;                  // Context set up next
+    std::deque<FrameContext *>inFlight_; // Oldest first
+    FrameContext* latest_    = nullptr;  // Last frame submitted
+    FrameContext* presented_ = nullptr;  // Last frame copied into the PBO
+    InterlaceHistory* interlaceHistory_ = nullptr; // Shared by the scanline backends of all contexts
     ResourceManager resourceManager_;
-    std::vector<DrawableObject *>drawableObjects_;
+    SceneGraph sceneGraph_;
+    std::vector<SceneDraw>sceneDraws_; // Submitted by the last prepareScene
+
+    // Scanline frames are split into bands of rows drawn in parallel, one
+    // context per scheduler slot, shared by the frames. Interlaced frames
+    // stay on the scanline context of their frame
+    std::vector<ZBufferScanLine *>bandContexts_;
+    bool bandedFrame_ = false;
+    bool viewMoving_  = false; // The camera moved since the frame before
 
     // Global settings
     int samples_       = 2;
+    bool multisample_  = true;  // Resolve samples in the rasterizer instead of supersampling
+    bool useTileRasterizer_ = false; // Initial backend, switch with B
+    bool visibilityBuffer_  = true;  // Deferred texturing in the scanline backend, toggle with V
+    bool lighting_          = true;  // Deferred lighting in the scanline backend, toggle with L
+    bool interlace_         = true;  // Interlaced scanline frames while the camera moves, toggle with I
+    bool progressive_       = true;  // Refine the image once the camera stops, toggle with P
+    bool bilinearFilter_    = false; // Texture filter of the scanline backend, toggle with F
     int windowWidth_   = 1024;
     int windowHeight_  = 768;
-    int textureWidth_  = windowWidth_ * samples_;
-    int textureHeight_ = windowHeight_ * samples_;
+    int textureWidth_  = multisample_ ? windowWidth_ : windowWidth_ * samples_;
+    int textureHeight_ = multisample_ ? windowHeight_ : windowHeight_ * samples_;
     float nearPlane_   = 0.1f;
     float farPlane_    = 100.0f;
     int bufferSize_    = textureWidth_ * textureHeight_ * 4;
 
+    // Dynamic resolution (texture size above is the upper bound)
+    bool dynamicResolution_ = true;
+    float frameBudget_      = 16.6f; // ms
+    float minScale_         = 0.25f;
+    int renderWidth_        = textureWidth_;
+    int renderHeight_       = textureHeight_;
+    int rasterWidth_        = textureWidth_; // Rasterizer size, applied to each frame context when bound
+    int rasterHeight_       = textureHeight_;
+    int rasterSamples_      = multisample_ ? samples_ : 1;
+    int uploadWidth_        = textureWidth_; // Size of the image held by the PBO
+    int uploadHeight_       = textureHeight_;
+    bool uploadPending_     = false; // The PBO holds a frame the texture does not have yet
+    bool uploadPartial_     = false; // That frame only changed uploadRect_
+    glm::ivec4 uploadRect_;
+    ResolutionGovernor governor_;
+
+    // Progressive refinement: moving frames are governed at one sample, a
+    // still camera then gets full resolution and then full samples, summed
+    // over jittered passes on top of the full resolution frame
+    enum RefineLevel { REFINE_MOVING, REFINE_RESOLUTION, REFINE_SAMPLES };
+    int refineLevel_          = REFINE_SAMPLES;
+    int refinePass_           = 0;     // Next pass, samples_ x samples_ in all
+    int framePass_            = -1;    // Pass of the frame being set up
+    bool refineDirect_        = false; // Changes of a still view, drawn with all samples at once
+    glm::vec2 jitter_;                 // Pixel offset of the pass
+    glm::mat4 lastViewMatrix_ = glm::mat4(0.0f);
+    std::vector<unsigned int>accumulation_; // Channel sums of the passes
+
+    // Partial redraw around moved nodes while the camera stays, scanline backend only
+    bool partialRedraw_ = true;
+    bool animate_       = false; // Spin the model, toggle with M
+    bool frameReusable_ = false; // The last frame still holds apart from moved nodes
+    bool partialFrame_  = false; // The last frame only redrew dirtyRect_
+    glm::ivec4 dirtyRect_;
+
+    // Level of detail
+    float lodRadius_     = 512.0f; // Projected radius (pixels) drawn at full detail
+    float lodHysteresis_ = 0.25f;  // Part of a level to pass before switching
+
+    // Lights in world space
+    std::vector<Light>lights_ = getDefaultLights();
+
     // Global matrices
     glm::mat4 viewMatrix_;
     glm::mat4 projectionMatrix_;
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <vector>
+
+class GeometryResource;
+
+// Quadric error edge collapse (Garland-Heckbert) for triangulated geometries.
+// Collapses are half-edge: the surviving vertex keeps its own position and uv.
+// Vertices only split by other attributes (like the normals of hard edges)
+// are welded, vertices on uv seams are locked so the texture layout is kept.
+class MeshSimplifier {
+public:
+
+    MeshSimplifier(GeometryResource* source);
+
+    // Build a simplified copy with at most targetFaces faces.
+    // Return nullptr if the source can not be simplified (e.g. not triangulated)
+    GeometryResource* simplify(int targetFaces);
+
+private:
+
+    struct Quadric {
+        double m[10] = { 0 };
+
+        void   addPlane(const glm::dvec4& plane,
+                        double            weight);
+
+        void   add(const Quadric& other);
+
+        double error(const glm::dvec3& p) const;
+    };
+
+    struct Collapse {
+        double cost;
+        int    from;
+        int    to;
+        int    fromStamp;
+        int    toStamp;
+
+        bool operator<(const Collapse& other) const
+        {
+            return cost > other.cost; // Min heap
+        }
+    };
+
+    bool prepare();
+
+    void pushEdge(int a,
+                  int b);
+
+    bool isValid(int from,
+                 int to);
+
+    void collapse(int from,
+                  int to);
+
+    // Copy of a welded vertex with the normal nearest to the one of corner,
+    // so each side of a hard edge keeps its own normals
+    int  closestCopy(int welded,
+                     int corner);
+
+    GeometryResource* build();
+
+private:
+
+    GeometryResource* source_;
+    std::vector<glm::dvec3>positions_;
+    std::vector<int>welded_;               // First vertex of the same position and uv
+    std::vector<std::vector<int> >copies_; // Vertices welded into each one
+    std::vector<glm::ivec3>triangles_;     // Welded vertices
+    std::vector<glm::ivec3>corners_;       // Source vertices of the triangles
+    std::vector<bool>triangleRemoved_;
+    std::vector<std::vector<int> >vertexTriangles_;
+    std::vector<Quadric>quadrics_;
+    std::vector<bool>locked_;
+    std::vector<bool>removed_;
+    std::vector<int>stamps_;
+    std::vector<Collapse>heap_;
+    int numTriangles_ = 0;
+};
@@ -11,10 +11,18 @@ class GeometryResource;
 class TextureResource;
 class DrawableObject;
 class ResourceManager;
+class SceneNode;
 
 class Model {
 public:
 
+    // Texture a geometry refers to, in material order
+    struct TextureRequest {
+        GeometryResource* geometry;
+        std::string path;
+        std::string typeName;
+    };
+
     Model()
     {}
 
@@ -22,6 +30,12 @@ public:
         parentManager_(manager)
     {}
 
+    // With deferTextures the manager is left untouched, textures are only
+    // recorded as requests so the model can be loaded off the main thread
+    Model(ResourceManager* manager, bool deferTextures) :
+        parentManager_(manager), deferTextures_(deferTextures)
+    {}
+
     Model(char* path)
     {
         this->loadModel(path);
@@ -29,18 +43,31 @@ public:
 
     void            loadModel(std::string path);
 
-    DrawableObject* getDrawableObject()
+    // Node hierarchy of the model, nullptr when loading failed
+    SceneNode* getSceneNode()
+    {
+        return root_;
+    }
+
+    // Drawables of the nodes, owned by the caller
+    const std::vector<DrawableObject *>& getDrawableObjects()
+    {
+        return drawables_;
+    }
+
+    // Textures left to load when deferring them
+    const std::vector<TextureRequest>& getTextureRequests()
     {
-        return drawable_;
+        return textureRequests_;
     }
 
 private:
 
-    void processNode(aiNode       * node,
-                     const aiScene* scene);
+    SceneNode* processNode(aiNode       * node,
+                           const aiScene* scene);
 
-    void processMesh(aiMesh       * mesh,
-                     const aiScene* scene);
+    GeometryResource* processMesh(aiMesh       * mesh,
+                                  const aiScene* scene);
 
     void loadMaterialTextures(aiMaterial      * mat,
                               aiTextureType     type,
@@ -50,8 +77,10 @@ private:
 private:
 
     ResourceManager* parentManager_;
-    DrawableObject* drawable_;
-    std::vector<GeometryResource *>geometryRcs_;
+    bool deferTextures_ = false;
+    SceneNode* root_ = nullptr;
+    std::vector<DrawableObject *>drawables_;
+    std::vector<TextureRequest>textureRequests_;
     std::string directory_;
     int totalTextureLoaded_ = 0;
 };
@@ -0,0 +1,196 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <GL/glew.h>
+
+#include <cmath>
+#include <vector>
+
+#include "Geometry.h"
+#include "HelperTools.h"
+#include "Lighting.h"
+#include "ResourceManager.h"
+
+// Nearest interpolation, averaging all textures (fallback when there is none)
+inline Pixel sampleTexture2D(const glm::vec2& texCoord, const std::vector<TextureResource *>* textures,
+                             Pixel fallback)
+{
+    if (textures->empty())
+    {
+        return fallback;
+    }
+
+    PixelSum sum;
+
+    for (TextureResource* resource: *textures)
+    {
+        Geometry::Texture* texture = resource->texture;
+        int   width                = texture->width;
+        int   height               = texture->height;
+        float s                    = clipUV(texCoord.s) * (width - 1);
+        float t                    = clipUV(texCoord.t) * (height - 1);
+        int   u                    = s - floor(s) < ceil(s) - s ?
+                                     static_cast<int>(floor(s)) : static_cast<int>(ceil(s));
+        int v = height - 1 - (t - floor(t) < ceil(t) - t ?
+                              static_cast<int>(floor(t)) : static_cast<int>(ceil(t)));
+
+        if (textures->size() == 1)
+        {
+            return texture->pixels[u + v * width] | PIXEL_OPAQUE;
+        }
+
+        sum.add(texture->pixels[u + v * width]);
+    }
+
+    return sum.average(static_cast<unsigned int>(textures->size())) | PIXEL_OPAQUE;
+}
+
+// Common interface of the rasterization backends
+class Rasterizer {
+public:
+
+    Rasterizer(GLfloat near,
+               GLfloat far) :
+        near_(near), far_(far)
+    {}
+
+    virtual ~Rasterizer()
+    {}
+
+    // Pipeline
+    virtual void reset() = 0;
+
+    // Change the output size and samples per pixel along each axis
+    virtual void resize(int width,
+                        int height,
+                        int samples) = 0;
+
+    virtual void draw(GLubyte* buffer) = 0;
+
+    virtual void insertPolygon(Geometry::Face  * face,
+                               GeometryResource* geometry,
+                               bool              useTexture) = 0;
+
+    // Every face of a geometry, backends may batch the setup
+    virtual void insertPolygons(GeometryResource* geometry,
+                                bool              useTexture)
+    {
+        for (auto face : geometry->faces)
+        {
+            insertPolygon(face, geometry, useTexture);
+        }
+    }
+
+    virtual const char* getName() = 0;
+
+    // Outer function
+    void setMVP(const glm::mat4& MVP)
+    {
+        mvp_ = MVP;
+
+        // The eye is where clip x, y and w vanish: solve the rows x, y, w in
+        // object space with the adjugate, in homogeneous form so the sign of
+        // the determinant is kept and a singular matrix needs no division
+        glm::vec3 rowX = glm::vec3(MVP[0][0], MVP[1][0], MVP[2][0]);
+        glm::vec3 rowY = glm::vec3(MVP[0][1], MVP[1][1], MVP[2][1]);
+        glm::vec3 rowW = glm::vec3(MVP[0][3], MVP[1][3], MVP[2][3]);
+        glm::vec3 adjX = glm::cross(rowY, rowW);
+        glm::vec3 adjY = glm::cross(rowW, rowX);
+        glm::vec3 adjW = glm::cross(rowX, rowY);
+
+        eye_ = glm::vec4(-(adjX * MVP[3][0] + adjY * MVP[3][1] + adjW * MVP[3][3]), glm::dot(rowX, adjX));
+    }
+
+    // Faces turned away from the camera, tested in object space before any
+    // vertex is projected. Same winding as the screen test (counter-clockwise
+    // is front), mirroring transforms included
+    bool isBackFace(Geometry::Face* face)
+    {
+        return !(glm::dot(face->plane, eye_) < 0);
+    }
+
+    void setViewDir(const glm::vec3& dir)
+    {
+        viewDir_ = dir;
+    }
+
+    // Camera of the frame, lets backends follow its motion between frames
+    void setViewProjection(const glm::mat4& viewProjection)
+    {
+        viewProjection_ = viewProjection;
+    }
+
+    // Model matrix of the following polygons, needed for lighting in world space
+    void setModel(const glm::mat4& model)
+    {
+        model_        = model;
+        normalMatrix_ = glm::transpose(glm::inverse(glm::mat3(model)));
+    }
+
+    void setLights(const std::vector<Light>& lights, const glm::vec3& eye)
+    {
+        lightingPass_.setLights(lights);
+        lightingPass_.setEyePosition(eye);
+    }
+
+    // Backends without a G-buffer ignore this
+    void setLighting(bool enable)
+    {
+        lighting_ = enable;
+    }
+
+    bool getLighting()
+    {
+        return lighting_;
+    }
+
+    // Time spent in the lighting pass of the last draw, in milliseconds
+    float getLightingTime()
+    {
+        return lightingTime_;
+    }
+
+    int getWidth()
+    {
+        return outWidth_;
+    }
+
+    int getHeight()
+    {
+        return outHeight_;
+    }
+
+    int getSamples()
+    {
+        return samples_;
+    }
+
+    int getNumPolygon()
+    {
+        return numPolygon_;
+    }
+
+protected:
+
+    // OpenGL variables
+    GLfloat near_;
+    GLfloat far_;
+    glm::mat4 mvp_;
+    glm::vec4 eye_; // Homogeneous, in the object space of mvp_
+    glm::vec3 viewDir_;
+    glm::mat4 viewProjection_;
+    Pixel bgColor_ = 0xff969696u; // Gray
+
+    // Output
+    int outWidth_  = 0;
+    int outHeight_ = 0;
+    int samples_   = 1;
+    int numPolygon_;
+
+    // Deferred lighting
+    bool lighting_ = false;
+    glm::mat4 model_;
+    glm::mat3 normalMatrix_;
+    LightingPass lightingPass_;
+    float lightingTime_ = 0.0f;
+};
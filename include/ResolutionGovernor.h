@@ -0,0 +1,44 @@
+#pragma once
+
+// Adjusts render resolution and sample count to keep the frame time on budget
+class ResolutionGovernor {
+public:
+
+    ResolutionGovernor(float budget     = 16.6f,
+                       float minScale   = 0.25f,
+                       int   maxSamples = 2);
+
+    // Feed the time (ms) spent on the last frame.
+    // Return true if scale or samples changed for the next frame
+    bool  update(float frameTime);
+
+    void  setBudget(float budget)
+    {
+        budget_ = budget;
+    }
+
+    float getBudget()
+    {
+        return budget_;
+    }
+
+    float getScale()
+    {
+        return scale_;
+    }
+
+    int getSamples()
+    {
+        return samples_;
+    }
+
+private:
+
+    float budget_;
+    float minScale_;
+    int maxSamples_;
+
+    float smoothed_ = 0;  // Averaged frame time
+    float scale_    = 1.0f;
+    int samples_;
+};
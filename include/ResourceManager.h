@@ -1,7 +1,12 @@
 #pragma once
 
 #include "Geometry.h"
+#include "SceneGraph.h"
+#include "TaskScheduler.h"
 
+#include <algorithm>
+#include <functional>
+#include <mutex>
 #include <string>
 #include <unordered_map>
 #include <vector>
@@ -39,11 +44,74 @@ public:
         {
             delete face;
         }
+
+        for (auto lod: lods)
+        {
+            delete lod;
+        }
+    }
+
+    // Level 0 is the geometry itself, higher levels are simplified copies
+    GeometryResource* getLod(int level)
+    {
+        return level <= 0 ? this : lods[std::min(level, static_cast<int>(lods.size())) - 1];
+    }
+
+    void computeBounds()
+    {
+        if (vertices.empty())
+        {
+            return;
+        }
+
+        glm::vec3 low  = vertices[0]->position;
+        glm::vec3 high = vertices[0]->position;
+
+        for (auto vertice: vertices)
+        {
+            low  = glm::min(low, vertice->position);
+            high = glm::max(high, vertice->position);
+        }
+
+        boundCenter = (low + high) * 0.5f;
+        boundRadius = 0;
+
+        for (auto vertice: vertices)
+        {
+            boundRadius = std::max(boundRadius, glm::length(vertice->position - boundCenter));
+        }
+    }
+
+    // Planes through the first three vertices of each face. Only the side
+    // of a point matters, so the normals are left unnormalized
+    void computeFacePlanes()
+    {
+        for (auto face: faces)
+        {
+            if (face->indices.size() < 3)
+            {
+                face->plane = glm::vec4(0.0f); // Always culled
+                continue;
+            }
+
+            const glm::vec3& a = vertices[face->indices[0]]->position;
+            glm::vec3 normal   = glm::cross(vertices[face->indices[1]]->position - a,
+                                            vertices[face->indices[2]]->position - a);
+
+            face->plane = glm::vec4(normal, -glm::dot(normal, a));
+        }
     }
 
     std::vector<Geometry::Vertice *>vertices;
     std::vector<Geometry::Face *>faces;
     std::vector<TextureResource *>textures;
+
+    // Simplified chain, each level has fewer faces than the previous one
+    std::vector<GeometryResource *>lods;
+
+    // Bounding sphere in model space
+    glm::vec3 boundCenter;
+    float boundRadius = 0;
 };
 
 class DrawableObject {
@@ -89,10 +157,41 @@ public:
                              const glm::mat4& modelMatrix = glm::mat4(),
                              std::string id               = std::string());
 
-    DrawableObject* loadModel(const std::string& path,
+    // Node hierarchy of the model under a root with modelMatrix, owned by the caller
+    SceneNode* loadModel(const std::string& path,
+                         const glm::mat4  & modelMatrix = glm::mat4(),
+                         std::string        id          = std::string());
+
+    // Same as loadModel but returns at once: the root is empty until the
+    // model is streamed in, and it draws untextured until its textures are.
+    // The root must stay alive while getStreamingCount() > 0
+    SceneNode* loadModelAsync(const std::string& path,
                               const glm::mat4  & modelMatrix = glm::mat4(),
                               std::string        id          = std::string());
 
+    // One of the prepared scenes [0-4] placed for the default camera, the
+    // model streamed in when async. nullptr for an unknown preset
+    SceneNode* loadPreset(int  preset,
+                          bool async = false);
+
+    // Whether streamed resources are waiting for commitStreamed
+    bool hasStreamed()
+    {
+        std::lock_guard<std::mutex> lock(commitMutex_);
+
+        return !commits_.empty();
+    }
+
+    // Swap streamed resources into the scene, on the main thread between
+    // frames: nothing being rasterized may refer to the changed geometries
+    bool commitStreamed();
+
+    // Models still loading
+    int getStreamingCount() const
+    {
+        return static_cast<int>(streamingModels_.size());
+    }
+
     DrawableObject* loadTexturedQuad(const std::string& texturePath,
                                      const glm::mat4  & modelMatrix = glm::mat4(),
                                      std::string        id          = std::string());
@@ -141,14 +240,19 @@ public:
 
     TextureResource* loadTextureResource(const std::string& path, const std::string& typeName, std::string id)
     {
-        TextureResource  * resource = new TextureResource;
-        Geometry::Texture* texture  = TextureFromFile(path);
+        return addTextureResource(TextureFromFile(path), typeName, id);
+    }
 
+private:
+
+    TextureResource* addTextureResource(Geometry::Texture* texture, const std::string& typeName, std::string id)
+    {
         if (texture == nullptr)
         {
             return nullptr;
         }
 
+        TextureResource* resource = new TextureResource;
         resource->texture = texture;
         resource->type    = typeName;
         resource->path    = id;
@@ -158,13 +262,29 @@ public:
         return resource;
     }
 
-private:
-
     Geometry::Texture* TextureFromFile(const std::string& path);
 
+    // Only touches the geometry, so models run it as concurrent tasks
+    void               generateLods(GeometryResource* geometry);
+
+    // Load a model on a worker, handing the results over through commits_
+    void               streamModel(const std::string& path,
+                                   const std::string& id);
+
+    void               postCommit(std::function<void()>commit);
+
 private:
 
     std::unordered_map<std::string, DrawableObject *>loadedObjects_;
+    std::unordered_map<std::string, SceneNode *>loadedModels_;
     std::unordered_map<std::string, GeometryResource *>loadedGeometries_;
     std::unordered_map<std::string, TextureResource *>loadedTextures_;
+
+    // Roots waiting for each model being streamed
+    std::unordered_map<std::string, std::vector<SceneNode *> >streamingModels_;
+    TaskGroup streaming_;
+
+    // Filled by the stream tasks, run by commitStreamed in order
+    std::mutex commitMutex_;
+    std::vector<std::function<void()> >commits_;
 };
@@ -0,0 +1,193 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <vector>
+
+class DrawableObject;
+
+// Node of the scene hierarchy, children are owned, the drawable is not
+class SceneNode {
+public:
+
+    SceneNode(DrawableObject* drawable = nullptr, const glm::mat4& localTransform = glm::mat4(1.0f)) :
+        drawable_(drawable), local_(localTransform)
+    {}
+
+    ~SceneNode();
+
+    SceneNode* addChild(SceneNode* child);
+
+    // Copy of the subtree sharing the drawables
+    SceneNode* clone() const;
+
+    // The subtree is recomputed at the next update
+    void setLocalTransform(const glm::mat4& localTransform);
+
+    const glm::mat4& getLocalTransform() const
+    {
+        return local_;
+    }
+
+    const glm::mat4& getWorldTransform() const
+    {
+        return world_;
+    }
+
+    // Model view projection of the last update
+    const glm::mat4& getMVP() const
+    {
+        return mvp_;
+    }
+
+    // World bounding sphere of the node and its subtree, radius < 0 when empty
+    const glm::vec3& getBoundCenter() const
+    {
+        return boundCenter_;
+    }
+
+    float getBoundRadius() const
+    {
+        return boundRadius_;
+    }
+
+    DrawableObject* getDrawable() const
+    {
+        return drawable_;
+    }
+
+    SceneNode* getParent() const
+    {
+        return parent_;
+    }
+
+    const std::vector<SceneNode *>& getChildren() const
+    {
+        return children_;
+    }
+
+    // Level of detail selected for a geometry of the drawable, kept per
+    // node because instances share their drawables
+    int& getLodLevel(size_t index)
+    {
+        if (index >= lodLevels_.size())
+        {
+            lodLevels_.resize(index + 1, 0);
+        }
+
+        return lodLevels_[index];
+    }
+
+private:
+
+    friend class SceneGraph;
+
+    // Flag this node and the path to the root
+    void markDirty();
+
+private:
+
+    DrawableObject* drawable_;
+    SceneNode* parent_ = nullptr;
+    std::vector<SceneNode *>children_;
+
+    glm::mat4 local_;
+    glm::mat4 world_;
+    glm::mat4 mvp_;
+    glm::vec3 boundCenter_ = glm::vec3(0.0f);
+    float boundRadius_     = -1.0f;
+    std::vector<int>lodLevels_;
+
+    bool dirty_        = true; // Local transform changed
+    bool subtreeDirty_ = true; // Some descendant changed
+};
+
+class SceneGraph {
+public:
+
+    SceneGraph() :
+        root_(new SceneNode)
+    {}
+
+    ~SceneGraph()
+    {
+        delete root_;
+    }
+
+    SceneNode* getRoot()
+    {
+        return root_;
+    }
+
+    // Propagate the transforms of dirty subtrees and refresh bounds, and the
+    // MVP of every node when the view projection changed
+    void update(const glm::mat4& viewProjection);
+
+    // Nodes with a drawable whose bounds intersect the view frustum, only
+    // walked again after the view or some node moved
+    const std::vector<SceneNode *>& collectVisible();
+
+    // Same for another view, from the transforms and bounds of the last
+    // update. Only reads the graph, views may be collected concurrently
+    void collectVisible(const glm::mat4        & viewProjection,
+                        std::vector<SceneNode *>& visible) const;
+
+    // Planes facing inwards, normalized
+    static void computeFrustum(const glm::mat4& viewProjection,
+                               glm::vec4        frustum[6]);
+
+    // Nodes whose world transform changed in the last update
+    const std::vector<SceneNode *>& getChangedNodes() const
+    {
+        return changedNodes_;
+    }
+
+    // Screen bounds (min x, min y, max x, max y of x / w and y / w) covered
+    // by the changed nodes before and after the last update, empty when
+    // min x > max x. Everything when the view projection changed
+    const glm::vec4& getDirtyBounds() const
+    {
+        return dirtyBounds_;
+    }
+
+    // Screen bounds of the bounding sphere of a node, see getDirtyBounds
+    glm::vec4 projectBounds(const SceneNode* node) const;
+
+    // Some transform changed since the last update
+    bool isDirty() const
+    {
+        return root_->dirty_ || root_->subtreeDirty_;
+    }
+
+    // Nodes recomputed in the last update
+    int getUpdatedCount() const
+    {
+        return updatedCount_;
+    }
+
+private:
+
+    void updateNode(SceneNode      * node,
+                    const glm::mat4& parentWorld,
+                    bool             parentChanged);
+
+    void updateBounds(SceneNode* node);
+
+    static void collectNode(SceneNode               * node,
+                            const glm::vec4           frustum[6],
+                            std::vector<SceneNode *>& visible);
+
+    void addDirtyBounds(const SceneNode* node);
+
+private:
+
+    SceneNode* root_;
+    glm::mat4 viewProjection_ = glm::mat4(0.0f);
+    bool viewChanged_ = false;
+    glm::vec4 frustum_[6]; // Planes facing inwards, normalized
+    std::vector<SceneNode *>changedNodes_;
+    glm::vec4 dirtyBounds_;
+    std::vector<SceneNode *>visibleNodes_;
+    bool visibleStale_ = true;
+    int updatedCount_  = 0;
+};
@@ -0,0 +1,452 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cmath>
+
+#include "ZBufferScanLine.h"
+
+// Span kernels of the scanline engine. Each kernel is a combination of
+// policies fixed at compile time, and one is picked per polygon at setup,
+// so the per-pixel loop has no branches on pipeline state.
+
+#ifdef USE_SSE2
+
+// Four texture coordinates, split into s and t
+inline void loadTexCoords4(const glm::vec2* texCoords, __m128& s, __m128& t)
+{
+    __m128 low  = _mm_loadu_ps(&texCoords[0].s);
+    __m128 high = _mm_loadu_ps(&texCoords[2].s);
+
+    s = _mm_shuffle_ps(low, high, _MM_SHUFFLE(2, 0, 2, 0));
+    t = _mm_shuffle_ps(low, high, _MM_SHUFFLE(3, 1, 3, 1));
+}
+
+// floor without SSE4.1, for coordinates well inside the int range
+inline __m128 floor4(__m128 x)
+{
+    __m128 truncated = _mm_cvtepi32_ps(_mm_cvttps_epi32(x));
+
+    return _mm_sub_ps(truncated, _mm_and_ps(_mm_cmpgt_ps(truncated, x), _mm_set1_ps(1.0f)));
+}
+
+// clipUV of four coordinates, same results: positive whole numbers give 1
+inline __m128 clipUV4(__m128 s)
+{
+    __m128 fraction = _mm_sub_ps(s, floor4(s));
+    __m128 whole    = _mm_and_ps(_mm_cmpeq_ps(fraction, _mm_setzero_ps()), _mm_cmpgt_ps(s, _mm_setzero_ps()));
+
+    return _mm_or_ps(_mm_andnot_ps(whole, fraction), _mm_and_ps(whole, _mm_set1_ps(1.0f)));
+}
+
+// lerpPixel on channels widened to 16 bits, the sums stay below 65536
+inline __m128i lerpChannels(__m128i a, __m128i b, __m128i weight)
+{
+    __m128i inverse = _mm_sub_epi16(_mm_set1_epi16(256), weight);
+
+    return _mm_srli_epi16(_mm_add_epi16(_mm_mullo_epi16(a, inverse), _mm_mullo_epi16(b, weight)), 8);
+}
+
+// Weights of four pixels repeated over their channels: pixels 0 and 1 in
+// low, 2 and 3 in high
+inline void spreadWeights(__m128i weights, __m128i& low, __m128i& high)
+{
+    __m128i packed = _mm_packs_epi32(weights, weights);
+    __m128i pairs  = _mm_unpacklo_epi16(packed, packed);
+
+    low  = _mm_unpacklo_epi32(pairs, pairs);
+    high = _mm_unpackhi_epi32(pairs, pairs);
+}
+
+#endif
+
+// Samplers (constructed per span, so texture fields stay in registers).
+// sampleRun gives the same texels as sample over a run of coordinates,
+// four at a time with SSE2
+struct NearestSampler {
+    explicit NearestSampler(const Geometry::Texture* texture) :
+        pixels(texture->pixels), width(texture->width), height(texture->height)
+    {}
+
+    explicit NearestSampler(const vector<TextureResource *>* textures) :
+        NearestSampler(textures->front()->texture)
+    {}
+
+    Pixel sample(const glm::vec2& texCoord) const
+    {
+        float s = clipUV(texCoord.s) * (width - 1);
+        float t = clipUV(texCoord.t) * (height - 1);
+        int   u = s - floor(s) < ceil(s) - s ? static_cast<int>(floor(s)) : static_cast<int>(ceil(s));
+        int   v = height - 1 - (t - floor(t) < ceil(t) - t ? static_cast<int>(floor(t)) : static_cast<int>(ceil(t)));
+
+        return pixels[u + v * width] | PIXEL_OPAQUE;
+    }
+
+    void sampleRun(const glm::vec2* texCoords, int count, Pixel* colors) const
+    {
+        int i = 0;
+
+#ifdef USE_SSE2
+        const __m128 scaleS = _mm_set1_ps(static_cast<float>(width - 1));
+        const __m128 scaleT = _mm_set1_ps(static_cast<float>(height - 1));
+        const __m128 half   = _mm_set1_ps(0.5f);
+
+        for (; i + 4 <= count; i += 4)
+        {
+            __m128 s;
+            __m128 t;
+
+            loadTexCoords4(texCoords + i, s, t);
+
+            // Rounds to the nearer texel like sample, ties up
+            alignas(16) int u[4];
+            alignas(16) int v[4];
+
+            _mm_store_si128(reinterpret_cast<__m128i *>(u),
+                            _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(clipUV4(s), scaleS), half)));
+            _mm_store_si128(reinterpret_cast<__m128i *>(v),
+                            _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(clipUV4(t), scaleT), half)));
+
+            for (int k = 0; k < 4; k++)
+            {
+                colors[i + k] = pixels[u[k] + (height - 1 - v[k]) * width] | PIXEL_OPAQUE;
+            }
+        }
+#endif
+
+        for (; i < count; i++)
+        {
+            colors[i] = sample(texCoords[i]);
+        }
+    }
+
+    const Pixel* pixels;
+    int          width;
+    int          height;
+};
+
+struct BilinearSampler {
+    explicit BilinearSampler(const Geometry::Texture* texture) :
+        pixels(texture->pixels), width(texture->width), height(texture->height)
+    {}
+
+    explicit BilinearSampler(const vector<TextureResource *>* textures) :
+        BilinearSampler(textures->front()->texture)
+    {}
+
+    Pixel sample(const glm::vec2& texCoord) const
+    {
+        float s  = clipUV(texCoord.s) * (width - 1);
+        float t  = (1.0f - clipUV(texCoord.t)) * (height - 1);
+        int   u0 = static_cast<int>(s);
+        int   v0 = static_cast<int>(t);
+        int   u1 = u0 + 1 < width ? u0 + 1 : u0;
+        int   v1 = v0 + 1 < height ? v0 + 1 : v0;
+
+        unsigned int fu = static_cast<unsigned int>((s - u0) * 256.0f);
+        unsigned int fv = static_cast<unsigned int>((t - v0) * 256.0f);
+
+        Pixel top    = lerpPixel(pixels[u0 + v0 * width], pixels[u1 + v0 * width], fu);
+        Pixel bottom = lerpPixel(pixels[u0 + v1 * width], pixels[u1 + v1 * width], fu);
+
+        return lerpPixel(top, bottom, fv) | PIXEL_OPAQUE;
+    }
+
+    void sampleRun(const glm::vec2* texCoords, int count, Pixel* colors) const
+    {
+        int i = 0;
+
+#ifdef USE_SSE2
+        const __m128  scaleS = _mm_set1_ps(static_cast<float>(width - 1));
+        const __m128  scaleT = _mm_set1_ps(static_cast<float>(height - 1));
+        const __m128  one    = _mm_set1_ps(1.0f);
+        const __m128  steps  = _mm_set1_ps(256.0f);
+        const __m128i lastU  = _mm_set1_epi32(width - 1);
+        const __m128i lastV  = _mm_set1_epi32(height - 1);
+        const __m128i zero   = _mm_setzero_si128();
+
+        for (; i + 4 <= count; i += 4)
+        {
+            __m128 s;
+            __m128 t;
+
+            loadTexCoords4(texCoords + i, s, t);
+
+            s = _mm_mul_ps(clipUV4(s), scaleS);
+            t = _mm_mul_ps(_mm_sub_ps(one, clipUV4(t)), scaleT);
+
+            __m128i u0 = _mm_cvttps_epi32(s);
+            __m128i v0 = _mm_cvttps_epi32(t);
+            __m128i fu = _mm_cvttps_epi32(_mm_mul_ps(_mm_sub_ps(s, _mm_cvtepi32_ps(u0)), steps));
+            __m128i fv = _mm_cvttps_epi32(_mm_mul_ps(_mm_sub_ps(t, _mm_cvtepi32_ps(v0)), steps));
+
+            // Next texel, the last one repeats (the compare gives -1)
+            __m128i u1 = _mm_sub_epi32(u0, _mm_cmplt_epi32(u0, lastU));
+            __m128i v1 = _mm_sub_epi32(v0, _mm_cmplt_epi32(v0, lastV));
+
+            alignas(16) int   left[4];
+            alignas(16) int   right[4];
+            alignas(16) int   top[4];
+            alignas(16) int   bottom[4];
+            alignas(16) Pixel corners[4][4];
+
+            _mm_store_si128(reinterpret_cast<__m128i *>(left), u0);
+            _mm_store_si128(reinterpret_cast<__m128i *>(right), u1);
+            _mm_store_si128(reinterpret_cast<__m128i *>(top), v0);
+            _mm_store_si128(reinterpret_cast<__m128i *>(bottom), v1);
+
+            for (int k = 0; k < 4; k++)
+            {
+                corners[0][k] = pixels[left[k] + top[k] * width];
+                corners[1][k] = pixels[right[k] + top[k] * width];
+                corners[2][k] = pixels[left[k] + bottom[k] * width];
+                corners[3][k] = pixels[right[k] + bottom[k] * width];
+            }
+
+            // Same blends as lerpPixel, two pixels per register
+            __m128i fuLow;
+            __m128i fuHigh;
+            __m128i fvLow;
+            __m128i fvHigh;
+
+            spreadWeights(fu, fuLow, fuHigh);
+            spreadWeights(fv, fvLow, fvHigh);
+
+            __m128i c00 = _mm_load_si128(reinterpret_cast<const __m128i *>(corners[0]));
+            __m128i c10 = _mm_load_si128(reinterpret_cast<const __m128i *>(corners[1]));
+            __m128i c01 = _mm_load_si128(reinterpret_cast<const __m128i *>(corners[2]));
+            __m128i c11 = _mm_load_si128(reinterpret_cast<const __m128i *>(corners[3]));
+
+            __m128i low = lerpChannels(lerpChannels(_mm_unpacklo_epi8(c00, zero), _mm_unpacklo_epi8(c10, zero), fuLow),
+                                       lerpChannels(_mm_unpacklo_epi8(c01, zero), _mm_unpacklo_epi8(c11, zero), fuLow),
+                                       fvLow);
+            __m128i high = lerpChannels(lerpChannels(_mm_unpackhi_epi8(c00, zero), _mm_unpackhi_epi8(c10, zero), fuHigh),
+                                        lerpChannels(_mm_unpackhi_epi8(c01, zero), _mm_unpackhi_epi8(c11, zero), fuHigh),
+                                        fvHigh);
+
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(colors + i),
+                             _mm_or_si128(_mm_packus_epi16(low, high), _mm_set1_epi32(static_cast<int>(PIXEL_OPAQUE))));
+        }
+#endif
+
+        for (; i < count; i++)
+        {
+            colors[i] = sample(texCoords[i]);
+        }
+    }
+
+    const Pixel* pixels;
+    int          width;
+    int          height;
+};
+
+// Average of several texture layers
+template<class Sampler>
+struct LayeredSampler {
+    explicit LayeredSampler(const vector<TextureResource *>* textures) :
+        textures(textures)
+    {}
+
+    Pixel sample(const glm::vec2& texCoord) const
+    {
+        PixelSum sum;
+
+        for (TextureResource* resource : *textures)
+        {
+            sum.add(Sampler(resource->texture).sample(texCoord));
+        }
+
+        return sum.average(static_cast<unsigned int>(textures->size())) | PIXEL_OPAQUE;
+    }
+
+    void sampleRun(const glm::vec2* texCoords, int count, Pixel* colors) const
+    {
+        for (int i = 0; i < count; i++)
+        {
+            colors[i] = sample(texCoords[i]);
+        }
+    }
+
+    const vector<TextureResource *>* textures;
+};
+
+// Texel lookup of a polygon, used when shading is deferred to the end of the line
+template<class Sampler>
+inline void samplePolygon(const ZPolygon& polygon, const glm::vec2* texCoords, int count, Pixel* colors)
+{
+    Sampler(polygon.textures).sampleRun(texCoords, count, colors);
+}
+
+// Shade policies: constructed per span, shade() runs for pixels passing the depth test
+struct FlatShade {
+    static const bool TEXTURED = false;
+
+    FlatShade(const SpanContext&, const ZPolygon& polygon) :
+        color(polygon.color)
+    {}
+
+    void shade(const SpanContext& context, int x, const glm::vec2&) const
+    {
+        context.frameBuffer[x] = color;
+    }
+
+    Pixel color;
+};
+
+// Flat color that also hides textured fragments recorded behind it
+struct DeferredFlatShade {
+    static const bool TEXTURED = false;
+
+    DeferredFlatShade(const SpanContext&, const ZPolygon& polygon) :
+        color(polygon.color)
+    {}
+
+    void shade(const SpanContext& context, int x, const glm::vec2&) const
+    {
+        context.frameBuffer[x] = color;
+        context.visPolygon[x]  = nullptr;
+    }
+
+    Pixel color;
+};
+
+// Record the fragment in the visibility buffer, textured once the line is resolved
+struct DeferredTextureShade {
+    static const bool TEXTURED = true;
+
+    DeferredTextureShade(const SpanContext&, ZPolygon& polygon) :
+        polygon(&polygon)
+    {}
+
+    void shade(const SpanContext& context, int x, const glm::vec2& texCoord) const
+    {
+        context.visPolygon[x]  = polygon;
+        context.visTexCoord[x] = texCoord;
+    }
+
+    ZPolygon* polygon;
+};
+
+template<class Sampler>
+struct TextureShade {
+    static const bool TEXTURED = true;
+
+    TextureShade(const SpanContext&, const ZPolygon& polygon) :
+        sampler(polygon.textures)
+    {}
+
+    void shade(const SpanContext& context, int x, const glm::vec2& texCoord) const
+    {
+        context.frameBuffer[x] = sampler.sample(texCoord);
+    }
+
+    Sampler sampler;
+};
+
+// Multisampling: shade once per pixel, then copy to every covered sample
+template<class Sampler>
+struct CachedTextureShade {
+    static const bool TEXTURED = true;
+
+    CachedTextureShade(const SpanContext&, ZPolygon& polygon) :
+        sampler(polygon.textures), polygon(&polygon)
+    {}
+
+    void shade(const SpanContext& context, int x, const glm::vec2& texCoord) const
+    {
+        ShadeCache& cache = context.shadeCache[x / context.samples];
+
+        if (cache.polygon != polygon)
+        {
+            cache.color   = sampler.sample(texCoord);
+            cache.polygon = polygon;
+        }
+
+        context.frameBuffer[x] = cache.color;
+    }
+
+    Sampler   sampler;
+    ZPolygon* polygon;
+};
+
+template<class Shade, bool LIGHTING>
+void spanKernel(const SpanContext& context, ActiveEdgePair& edgePair, int start_x, int end_x)
+{
+    Shade shade(context, *edgePair.polygon);
+
+    // Depth interpolation
+    float z_l = edgePair.z_l;
+    float z_x = z_l;
+    float z_r = z_x + edgePair.dz_x * (end_x - start_x + 1);
+
+    // Texture interpolation
+    glm::vec2 t_x = edgePair.t_l;
+    glm::vec2 dtex;
+
+    if (Shade::TEXTURED)
+    {
+        dtex = (edgePair.t_r * z_r - edgePair.t_l * z_l) / static_cast<float>(end_x - start_x + 1);
+    }
+
+    // Start at the clip range, texture times z is linear along the span
+    int first = std::max(start_x, context.clipLeft);
+    int last  = std::min(end_x, context.clipRight);
+
+    if (first > start_x)
+    {
+        z_x = z_l + edgePair.dz_x * (first - start_x);
+
+        if (Shade::TEXTURED)
+        {
+            t_x = (edgePair.t_l * z_l + dtex * static_cast<float>(first - start_x)) / z_x;
+        }
+    }
+
+    // Scan along edge pair
+    for (int x = first; x <= last; x++)
+    {
+        if (z_x > context.zBuffer[x])
+        {
+            context.zBuffer[x] = z_x;
+
+            if (LIGHTING)
+            {
+                context.surface[x] = edgePair.polygon;
+            }
+
+            shade.shade(context, x, t_x);
+        }
+
+        // Step interpolation
+        float z_x_o = z_x;
+        z_x += edgePair.dz_x;
+
+        if (Shade::TEXTURED)
+        {
+            t_x = (t_x * z_x_o + dtex) / z_x;
+        }
+    }
+}
+
+// Sampler of a textured shade, offset within the SPAN_TEXTURE and SPAN_TEXTURE_CACHED groups
+enum SpanFilter {
+    SPAN_NEAREST,
+    SPAN_BILINEAR,
+    SPAN_NEAREST_LAYERED,
+    SPAN_BILINEAR_LAYERED,
+    SPAN_FILTER_COUNT
+};
+
+// Kernel table, indexed by [shade][lighting]
+enum SpanShade {
+    SPAN_FLAT,
+    SPAN_FLAT_DEFERRED,
+    SPAN_TEXTURE_DEFERRED,
+    SPAN_TEXTURE,
+    SPAN_TEXTURE_CACHED = SPAN_TEXTURE + SPAN_FILTER_COUNT,
+    SPAN_SHADE_COUNT    = SPAN_TEXTURE_CACHED + SPAN_FILTER_COUNT
+};
+
+extern const SpanKernel   SPAN_KERNELS[SPAN_SHADE_COUNT][2];
+extern const TexelSampler TEXEL_SAMPLERS[SPAN_FILTER_COUNT];
@@ -0,0 +1,119 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <GL/glew.h>
+
+#include <algorithm>
+#include <vector>
+
+#include "Lighting.h"
+#include "SceneGraph.h"
+
+class GeometryResource;
+class ZBufferScanLine;
+
+struct StereoStatistics {
+    float sharedMs  = 0.0f; // Culling, back faces and vertex transforms of both eyes
+    float viewMs[2] = {};   // Projection, setup and raster of each eye, run concurrently
+    float frameMs   = 0.0f;
+
+    // Part of the cost of the second eye that was not repeated: the shared
+    // stage over what the eye would have cost on its own
+    float getSavedFraction() const
+    {
+        return sharedMs / std::max(sharedMs + viewMs[1], 1e-6f);
+    }
+};
+
+// Two eyes of one camera in a single pass over the scene. Nodes are culled
+// once against both frustums, face planes are tested against both eyes in
+// one sweep and every vertex is transformed once: the eyes only differ by
+// their clip x, which is the center one plus offset + slope * w. Each eye
+// then projects, sets up and rasterizes its polygons with its own
+// ZBufferScanLine, both concurrently
+class StereoRenderer {
+public:
+
+    StereoRenderer(SceneGraph& scene,
+                   int         width,
+                   int         height,
+                   int         samples = 1,
+                   float       near    = 0.1f,
+                   float       far     = 100.0f);
+
+    ~StereoRenderer();
+
+    // Eyes separation apart on the x axis of the view, their off axis
+    // frustums meet at convergence (zero parallax) in front of the camera
+    void setEyes(float separation,
+                 float convergence)
+    {
+        separation_  = separation;
+        convergence_ = convergence;
+    }
+
+    void setLights(const std::vector<Light>& lights)
+    {
+        lights_ = lights;
+    }
+
+    // Both eyes of the center camera, BGRA images of width x height. The
+    // projection has to be a perspective one (w = -z in view space)
+    void render(const glm::mat4& view,
+                const glm::mat4& projection,
+                GLubyte        * left,
+                GLubyte        * right);
+
+    // Of the last render
+    const StereoStatistics& getStatistics() const
+    {
+        return statistics_;
+    }
+
+private:
+
+    // A geometry visible to at least one eye, with its share of the buffers
+    struct SharedGeometry {
+        SceneNode       * node;
+        GeometryResource* geometry;
+        int               views;      // Bit e for eye e
+        int               firstVertex;
+        int               firstFace;
+    };
+
+    void collectNode(SceneNode      * node,
+                     const glm::vec4  frustums[2][6],
+                     int              views);
+
+    // Transform the vertices and test the faces of one geometry
+    void shareGeometry(const SharedGeometry& shared);
+
+    void renderEye(int      eye,
+                   GLubyte* image);
+
+private:
+
+    SceneGraph& scene_;
+    int width_;
+    int height_;
+    int samples_;
+    float separation_  = 0.5f;
+    float convergence_ = 25.0f;
+    std::vector<Light>lights_;
+    ZBufferScanLine* eyes_[2];
+
+    // Current frame
+    glm::mat4 viewProjection_; // Center eye
+    glm::mat4 eyeView_[2];
+    glm::mat4 eyeProjection_[2];
+    float clipOffset_[2];      // Clip x of eye e: center x + offset + slope * w
+    float clipSlope_[2];
+
+    std::vector<SharedGeometry>geometries_;
+    std::vector<glm::vec3>clip_;          // x, y and w at the center eye per vertex
+    std::vector<unsigned char>faceViews_; // Bit e set when the face fronts eye e
+    int vertexCount_ = 0;
+    int faceCount_   = 0;
+
+    StereoStatistics statistics_;
+};
@@ -0,0 +1,136 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Tasks submitted together, waited on together. A group submitted from a
+// running task is a child of that task's group, which has to outlive it
+class TaskGroup {
+public:
+
+    TaskGroup() :
+        pending_(0), parent_(nullptr)
+    {}
+
+private:
+
+    friend class TaskScheduler;
+
+    std::atomic<int> pending_;
+    std::atomic<TaskGroup *> parent_;
+};
+
+struct TaskStatistics {
+    long long submitted = 0;
+    long long executed  = 0;
+    long long stolen    = 0; // Run by another thread than the one that queued them
+    int       queued    = 0; // Waiting in the deques right now
+    int       maxQueued = 0; // Deepest total queue since the last reset
+};
+
+// Work stealing scheduler: every worker owns a deque, pushes and pops its
+// own tasks at the back and steals from the front of the others when it
+// runs dry. Threads outside the pool share one more deque, and help running
+// tasks of the group they wait for, so nested parallel loops never block a
+// core and a wait never picks up unrelated work such as loading. One
+// shared instance serves loading, setup, raster and post stages so they do
+// not oversubscribe the cores
+class TaskScheduler {
+public:
+
+    // workers < 0: one less than the hardware threads, the waiting thread
+    // takes the last core. With pinThreads, worker i runs on core i + 1
+    explicit TaskScheduler(int  workers    = -1,
+                           bool pinThreads = false);
+
+    ~TaskScheduler();
+
+    // Restart the pool, only while no task is queued
+    void configure(int  workers,
+                   bool pinThreads);
+
+    static TaskScheduler& shared();
+
+    void submit(TaskGroup            & group,
+                std::function<void()>  task);
+
+    // Run queued tasks of the group and its children until every task of
+    // the group finished
+    void wait(TaskGroup& group);
+
+    // body(first, last) over [begin, end) in chunks of grain items
+    void parallelFor(int                                   begin,
+                     int                                   end,
+                     int                                   grain,
+                     const std::function<void(int, int)> & body);
+
+    int getWorkerCount() const
+    {
+        return static_cast<int>(threads_.size());
+    }
+
+    // Deque of the calling thread: 0 outside the pool, worker i uses i + 1.
+    // A thread runs one task of a slot at a time, so per slot scratch is safe
+    int getSlot() const;
+
+    int getSlotCount() const
+    {
+        return static_cast<int>(queues_.size());
+    }
+
+    TaskStatistics getStatistics() const;
+
+    void resetStatistics();
+
+private:
+
+    struct Task {
+        std::function<void()> run;
+        TaskGroup* group = nullptr;
+    };
+
+    struct TaskQueue {
+        std::mutex mutex;
+        std::deque<Task>tasks;
+    };
+
+    void start(int  workers,
+               bool pinThreads);
+
+    void stop();
+
+    void workerLoop(int  slot,
+                    bool pin);
+
+    // Own deque first, newest task, then the oldest task of another deque.
+    // With a scope, only tasks of that group or its children
+    bool findTask(int        slot,
+                  Task     & task,
+                  TaskGroup* scope = nullptr);
+
+    void runTask(Task& task);
+
+private:
+
+    std::vector<std::thread>threads_;
+    std::vector<std::unique_ptr<TaskQueue> >queues_;
+
+    // Idle workers sleep until something is queued
+    std::mutex sleepMutex_;
+    std::condition_variable wake_;
+    std::atomic<int> sleeping_;
+    std::atomic<bool> stop_;
+
+    // Statistics
+    std::atomic<int> queued_;
+    std::atomic<int> maxQueued_;
+    std::atomic<long long> submitted_;
+    std::atomic<long long> executed_;
+    std::atomic<long long> stolen_;
+};
@@ -0,0 +1,108 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <GL/glew.h>
+
+#include <vector>
+using namespace std;
+
+#include "Rasterizer.h"
+
+// A screen space triangle set up for half-space rasterization
+struct TileTriangle {
+    float     a[3];       // Edge functions a * x + b * y + c, inside when positive
+    float     b[3];
+    float     c[3];
+    bool      topLeft[3]; // Points exactly on a top or left edge are inside
+    glm::vec3 depth;      // Plane of 1 / w: x * depth.x + y * depth.y + depth.z
+    glm::vec3 texS;       // Plane of s / w
+    glm::vec3 texT;       // Plane of t / w
+    int       minX;       // Bounding box in pixels
+    int       maxX;
+    int       minY;
+    int       maxY;
+    Pixel                      color;
+    vector<TextureResource *>* textures = nullptr;
+};
+
+// Triangles set up by one task, binned afterwards in submission order
+struct TileSetupChunk {
+    vector<TileTriangle>triangles;
+    vector<int>polygonEnds; // End of the triangles of each polygon
+};
+
+// Bins triangles into screen tiles, then rasterizes the tiles in parallel
+// with SIMD edge functions and a depth buffer local to each tile. Setup and
+// tiles run as tasks of the shared TaskScheduler
+class TileRasterizer : public Rasterizer {
+public:
+
+    // The tile size must be a multiple of 4
+    TileRasterizer(int     width,
+                   int     height,
+                   GLfloat near,
+                   GLfloat far,
+                   int     samples  = 1,
+                   int     tileSize = 16);
+
+    // Pipeline
+    void reset() override;
+
+    void resize(int width,
+                int height,
+                int samples) override;
+
+    void draw(GLubyte* buffer) override;
+
+    void insertPolygon(Geometry::Face  * face,
+                       GeometryResource* geometry,
+                       bool              useTexture) override;
+
+    // Faces are set up in parallel chunks, then binned in order
+    void insertPolygons(GeometryResource* geometry,
+                        bool              useTexture) override;
+
+    const char* getName() override
+    {
+        return "tile";
+    }
+
+private:
+
+    // Project a polygon and set up its fan, safe to call from several threads
+    void setupPolygon(Geometry::Face  * face,
+                      GeometryResource* geometry,
+                      bool              useTexture,
+                      TileSetupChunk  & chunk);
+
+    bool setupTriangle(const glm::vec3         * p,
+                       const glm::vec2         * tex,
+                       Pixel                     color,
+                       vector<TextureResource *>*textures,
+                       TileTriangle            & tri);
+
+    bool binTriangle(const TileTriangle& tri);
+
+    void binChunk(const TileSetupChunk& chunk);
+
+    void drawTile(int           tileX,
+                  int           tileY,
+                  GLubyte     * buffer,
+                  float       * depth,
+                  Pixel       * color);
+
+private:
+
+    int tileSize_;
+    int tilesX_ = 0;
+    int tilesY_ = 0;
+
+    // Geometry tables
+    vector<TileTriangle>triangles_;
+    vector<vector<int> >bins_; // Triangle indices per tile, in submission order
+    vector<TileSetupChunk>setupChunks_;
+
+    // Tile buffers per scheduler slot
+    vector<vector<float> >tileDepth_;
+    vector<vector<Pixel> >tileColor_;
+};
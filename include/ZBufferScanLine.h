@@ -3,11 +3,14 @@
 #include <glm/glm.hpp>
 #include <GL/glew.h>
 
+#include <atomic>
 #include <vector>
 #include <set>
 using namespace std;
 
 #include "Geometry.h"
+#include "LineBuckets.h"
+#include "Rasterizer.h"
 
 class GeometryResource;
 class TextureResource;
@@ -24,6 +27,29 @@ struct ZEdge {
 };
 typedef vector<ZEdge *> EdgeTable;
 
+struct ZPolygon;
+struct ActiveEdgePair;
+struct ShadeCache;
+
+// Line buffers a span kernel writes to, refreshed for every line
+struct SpanContext {
+    float      * zBuffer     = nullptr;
+    Pixel      * frameBuffer = nullptr;
+    ZPolygon  ** visPolygon  = nullptr;
+    glm::vec2  * visTexCoord = nullptr;
+    ZPolygon  ** surface     = nullptr;
+    ShadeCache * shadeCache  = nullptr;
+    int          samples     = 1;
+    int          clipLeft    = 0; // Sample range of the line that may be written
+    int          clipRight   = 0;
+};
+
+// Inner loop over [start_x, end_x] of an edge pair, see SpanKernels.h
+typedef void (*SpanKernel)(const SpanContext&, ActiveEdgePair&, int, int);
+
+// Texels of a polygon for a run of texture coordinates
+typedef void (*TexelSampler)(const ZPolygon&, const glm::vec2*, int, Pixel*);
+
 struct ZPolygon {
     ZPolygon()
     {}
@@ -37,11 +63,15 @@ struct ZPolygon {
     }
 
     glm::vec4                  depthPlane; // Vertices depth function
-    unsigned char              color[4];
+    Pixel                      color;
     int                        dy;         // Remaining scanlines
     EdgeTable                  edges;
     EdgeTable                  unpairedEdges;
     vector<TextureResource *>* textures = nullptr;
+    glm::vec3                  normalPlanes[3];   // World normal / w over the screen, for lighting
+    glm::vec3                  positionPlanes[3]; // World position / w over the screen
+    SpanKernel                 kernel     = nullptr; // Chosen at insertion from the pipeline state
+    TexelSampler               sampler    = nullptr; // Texture filter, for deferred texturing
 };
 typedef vector<ZPolygon *> PolygonTable;
 
@@ -57,59 +87,251 @@ struct ActiveEdgePair {
     glm::vec2 dt_x; // Plane texture step (x)
     glm::vec2 dt_y; // Plane texture stop (y)
     ZPolygon* polygon = nullptr;
+    bool      triangle = false; // Set up completely at insertion, see drawEdgePair<true>
+    int       dy       = 0;     // Remaining scanlines of a triangle pair
 };
 typedef vector<ActiveEdgePair *> ActiveEdgePairTable;
 
-class ZBufferScanLine {
+// One line of a small triangle, stepped at insertion instead of through the
+// active edge pair table
+struct MicroSpan {
+    ZPolygon* polygon;
+    int       start_x;
+    int       end_x;
+    float     z_l;  // Plane depth (left)
+    float     dz_x; // Plane depth step (x)
+    glm::vec2 t_l;  // Plane texture (left)
+    glm::vec2 t_r;  // Plane texture (right)
+};
+
+// Shaded and lit colors of one output pixel, reused by all samples of the same polygon
+struct ShadeCache {
+    ZPolygon* polygon = nullptr;
+    Pixel     color;
+    ZPolygon* litPolygon = nullptr;
+    Pixel     litColor;
+};
+
+// Interlaced rendering: the current frame is drawn into color[current], the
+// other buffers hold the previous frame and its depth per pixel. Contexts
+// drawing consecutive frames share one, drawing one after the other
+struct InterlaceHistory {
+    std::atomic<bool> valid{ false };
+    int               field   = 0; // Parity of the rows drawn by the next interlaced frame
+    int               current = 0;
+    int               width   = 0;
+    int               height  = 0;
+    vector<Pixel>     color[2];
+    vector<float>     depth[2];
+    glm::mat4         lastViewProjection;
+};
+
+class ZBufferScanLine : public Rasterizer {
 public:
 
+    // With samples > 1, rasterize samples x samples points per pixel (MSAA)
+    // and resolve them into a width x height output
     ZBufferScanLine(int     width,
                     int     height,
                     GLfloat near,
-                    GLfloat far);
+                    GLfloat far,
+                    int     samples = 1);
 
     ~ZBufferScanLine();
 
     // Pipeline
-    void reset();
+    void reset() override;
+
+    // Buffers only grow, so frequent changes are cheap
+    void resize(int width,
+                int height,
+                int samples) override;
 
-    void draw(GLubyte* buffer);
+    void draw(GLubyte* buffer) override;
 
     void drawLine(int index);
 
+    // Output row, from its sample lines when multisampling
+    void drawRow(int      row,
+                 GLubyte* dst);
+
+    void resolveLine(GLubyte* dst);
+
+    // TRIANGLE pairs keep their edges for their whole lifetime, so edge
+    // matching and rollback are compiled out
+    template<bool TRIANGLE>
     void drawEdgePair(ActiveEdgePair& edgePair);
 
+    // Keep the active table ordered by left x, the first carried pairs are
+    // those of the previous line
+    void sortActiveEdgePairs(int carried);
+
+    // Merge the x ranges of the active edge pairs and micro spans of a line
+    // into coveredSpans_
+    void collectSpans(int index);
+
+    // Write the background into the uncovered part of the current line
+    void fillGaps();
+
+    void fillBackground(Pixel* dst,
+                        int    count);
+
+    // Texture the visible fragments recorded for the current line
+    void shadeLine();
+
+    // Pixels [first, last) of the line showing the same polygon
+    void shadeRun(ZPolygon* polygon,
+                  int       first,
+                  int       last);
+
+    // Light the current line from the surfaces left after depth testing
+    void lightLine(int index);
+
     void insertActiveEdgePairs(int       lineIndex,
                                ZPolygon& polygon);
 
     // Outer function
-    void setMVP(const glm::mat4& MVP)
+    void* getLineFrameBuffer()
+    {
+        return frameBuffer_;
+    }
+
+    void insertPolygon(Geometry::Face  * face,
+                       GeometryResource* geometry,
+                       bool              useTexture) override;
+
+    // Front facing triangles are projected and trivially rejected in batches
+    void insertPolygons(GeometryResource* geometry,
+                        bool              useTexture) override;
+
+    // Polygon already in screen space (x, y in samples, 1 / w), for callers
+    // sharing vertex transforms between views. Back faces are the caller's
+    void insertProjectedPolygon(Geometry::Face         * face,
+                                GeometryResource       * geometry,
+                                bool                     useTexture,
+                                const vector<glm::vec3>& projected)
     {
-        mvp_ = MVP;
+        // Polygons off the dirty region leave it unchanged
+        if (partial_ && outsideRegion(projected.data(), projected.size()))
+        {
+            return;
+        }
+
+        insertProjected(face, geometry, useTexture, projected.data(), projected.size());
     }
 
-    void setViewDir(const glm::vec3& dir)
+    const char* getName() override
     {
-        viewDir_ = dir;
+        return "scanline";
     }
 
-    void* getLineFrameBuffer()
+    // While the camera moves, draw every other row and rebuild the others
+    // from the previous frame, reprojected with the camera motion
+    void setInterlacing(bool enable)
     {
-        return frameBuffer_;
+        interlace_ = enable;
     }
 
-    void insertPolygon(Geometry::Face  * face,
-                       GeometryResource* geometry,
-                       bool              useTexture);
+    bool getInterlacing()
+    {
+        return interlace_;
+    }
 
-    int getNumPolygon()
+    // Continue the interlaced frames of other contexts, nullptr for the own
+    // history. Frames sharing one must not be drawn at the same time
+    void setHistory(InterlaceHistory* history)
     {
-        return numPolygon_;
+        history_ = history != nullptr ? history : &ownHistory_;
+    }
+
+    // Whether the next draw is interlaced, valid once the frames sharing the
+    // history before it are drawn
+    bool willInterlace()
+    {
+        return interlace_ && !partial_ && history_->valid && (history_->width == outWidth_) &&
+               (history_->height == outHeight_) && (viewProjection_ != history_->lastViewProjection);
+    }
+
+    // Whether the last frame was drawn interlaced
+    bool isInterlacedFrame()
+    {
+        return interlace_ && interlacedFrame_;
+    }
+
+    // Frames were drawn by other contexts since the last one, the next
+    // frame cannot be rebuilt from it
+    void invalidateHistory()
+    {
+        history_->valid  = false;
+        interlacedFrame_ = false;
+    }
+
+    // Only redraw the output rectangle [left, right] x [bottom, top] at the
+    // next draw, leaving the rest of the buffer as it is. Set it before
+    // inserting polygons, those outside are dropped. Cleared by resize
+    void setDirtyRegion(int left,
+                        int bottom,
+                        int right,
+                        int top);
+
+    void clearDirtyRegion();
+
+    bool hasDirtyRegion()
+    {
+        return partial_;
+    }
+
+    // Resolve visibility first and texture each pixel once (deferred texturing)
+    void setVisibilityBuffer(bool enable)
+    {
+        visibilityBuffer_ = enable;
+    }
+
+    bool getVisibilityBuffer()
+    {
+        return visibilityBuffer_;
+    }
+
+    // Bilinear instead of nearest texture filtering, for polygons inserted afterwards
+    void setBilinearFilter(bool enable)
+    {
+        bilinearFilter_ = enable;
+    }
+
+    bool getBilinearFilter()
+    {
+        return bilinearFilter_;
     }
 
 private:
 
+    // Interlacing
+    void saveDepth(float* dst);
+
+    void reconstructRows();
+
     // Preparation
+    void selectKernel(ZPolygon& polygon);
+
+    // Projects, classifies and compacts up to TRIANGLE_BATCH triangles
+    void setupTriangleBatch(Geometry::Face ** faces,
+                            int               count,
+                            GeometryResource* geometry,
+                            bool              useTexture);
+
+    // Everything after projection, shared by single and batched insertion.
+    // Batched triangles inside the window come with their top and bottom row
+    void insertProjected(Geometry::Face  * face,
+                         GeometryResource* geometry,
+                         bool              useTexture,
+                         const glm::vec3 * projected,
+                         int               count,
+                         const glm::ivec2* rows = nullptr);
+
+    // Whether the screen bounds of a polygon miss the dirty region
+    bool outsideRegion(const glm::vec3* projected,
+                       int              count);
+
     ZEdge* generateEdge(glm::vec3* p1,
                         glm::vec3* p2,
                         int      & top,
@@ -118,28 +340,110 @@ private:
                         glm::vec2  tex1,
                         glm::vec2  tex2);
 
+    bool initEdge(ZEdge    & zEdge,
+                  glm::vec3* p1,
+                  glm::vec3* p2,
+                  int      & top,
+                  int      & bottom,
+                  bool       useTexture,
+                  glm::vec2  tex1,
+                  glm::vec2  tex2);
+
     ActiveEdgePair* generateEdgePair(ZEdge   * left,
                                      ZEdge   * right,
                                      ZPolygon& polygon);
 
+    // Fast path for triangles inside the window: at most two edge pairs,
+    // queued for the lines they start on, or micro spans for small ones
+    void setupTriangle(ZPolygon                & polygon,
+                       const glm::vec3         * projected,
+                       const glm::ivec2        & rows,
+                       const vector<glm::vec2> & texCoords,
+                       bool                      useTexture);
+
+    ActiveEdgePair* generateTrianglePair(ZEdge   * left,
+                                         ZEdge   * right,
+                                         ZPolygon& polygon,
+                                         int       line,
+                                         int       lines);
+
+    void initTrianglePair(ActiveEdgePair& pair,
+                          ZEdge         * left,
+                          ZEdge         * right,
+                          ZPolygon      & polygon,
+                          int             line,
+                          int             lines);
+
+    // Polygons of the triangle path, taken from trianglePool_ and given
+    // back with their edges freed
+    ZPolygon* acquireTriangle();
+    void      recycleTriangle(ZPolygon& polygon);
+
+    // Step a pair of a small triangle through all its lines into microSpans_
+    void addMicroSpans(ActiveEdgePair& pair,
+                       int             line);
+
 private:
 
-    // OpenGL variables
+    // Raster size, counted in samples
     int width_;
     int height_;
-    GLfloat near_;
-    GLfloat far_;
-    glm::mat4 mvp_;
-    glm::vec3 viewDir_;
-    unsigned char bgColor_[4] = { 150, 150, 150, 255 };
 
     // Buffers
-    float* zBuffer_;
+    float* zBuffer_ = nullptr;
     GLubyte* frameBuffer_;
-    int numPolygon_;
+    int zBufferSize_      = 0;
+    int sampleBufferSize_ = 0;
+
+    // Multisampling
+    GLubyte* sampleBuffer_ = nullptr; // Sample colors of one pixel row
+    vector<ShadeCache>shadeCache_;
+
+    // Visibility buffer of one line: nearest textured polygon and its coordinate
+    bool visibilityBuffer_ = true;
+    vector<ZPolygon *>visPolygon_;
+    vector<glm::vec2>visTexCoord_;
+    vector<int>runPixels_; // Pixels a multisampled run shades, and their texels
+    vector<glm::vec2>runTexCoords_;
+    vector<Pixel>runColors_;
+
+    // Deferred lighting: nearest polygon of each pixel and its surface
+    vector<ZPolygon *>surface_;
+    GBufferLine gBuffer_;
+    vector<int>litPixels_; // Pixels a multisampled line lights, and their colors
+    vector<Pixel>litColors_;
+
+    // Interlaced rendering
+    bool interlace_       = false;
+    bool interlacedFrame_ = false;
+    bool rasterLine_      = true; // Else drawLine only steps the edges
+    bool streamOutput_    = true; // Rows go straight to the output, which is never read back
+    InterlaceHistory ownHistory_;
+    InterlaceHistory* history_ = &ownHistory_;
+
+    // Partial redraw, in output pixels
+    bool partial_     = false;
+    int regionLeft_   = 0;
+    int regionRight_  = 0;
+    int regionBottom_ = 0;
+    int regionTop_    = 0;
+
+    // Span kernels
+    bool bilinearFilter_ = false;
+    SpanContext context_;
+
+    // Merged [start, end] pixel ranges covered by spans on the current line
+    vector<pair<int, int> >coveredSpans_;
 
     // Geometry tables
-    vector<PolygonTable>polygonTables_;
+    LineBuckets<ZPolygon *>polygonBuckets_;    // Polygons by starting line
+    PolygonTable trianglePool_;                // Owns the polygons of the triangle path
+    int usedTriangles_ = 0;                    // Taken from the pool this frame
+    LineBuckets<ActiveEdgePair *>pairBuckets_; // Triangle pairs by starting line
+    LineBuckets<MicroSpan>microSpans_;         // Lines of small triangles
+    ActiveEdgePair microPair_;                 // Hands a micro span to the span kernels
     PolygonTable activePolygonTable_;
-    ActiveEdgePairTable activeEdgePairTable_;
+    ActiveEdgePairTable activeEdgePairTable_; // Sorted by left x
+    ActiveEdgePairTable mergedPairs_;
+    vector<glm::vec2>windowTexCoord_; // Texture coordinates of the polygon being inserted
 };
@@ -0,0 +1,334 @@
+#include "BandRenderer.h"
+
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <spawn.h>
+#include <sys/wait.h>
+#include <unistd.h>
+extern char** environ;
+#endif
+
+using namespace std;
+
+#include "Camera.h"
+#include "ImageWriter.h"
+#include "ResourceManager.h"
+#include "SceneGraph.h"
+#include "ZBufferScanLine.h"
+
+static const float BAND_NEAR      = 0.1f;
+static const float BAND_FAR       = 100.0f;
+static const float BAND_MIN_MS    = 0.01f; // Keeps empty bands from costing nothing
+static const int   BAND_ARGUMENTS = 9;     // Of a worker command line
+
+BandRenderer::BandRenderer(const Settings& settings) :
+    settings_(settings)
+{
+    settings_.workers = min(max(settings_.workers, 1), min(MAX_BAND_WORKERS, settings_.height));
+}
+
+bool BandRenderer::render(const string& executable, const string& output)
+{
+    const int workers = settings_.workers;
+    const int width   = settings_.width;
+    const int height  = settings_.height;
+
+#ifdef _WIN32
+    string name = "Local\\scanline-bands-" + to_string(GetCurrentProcessId());
+#else
+    string name = "/scanline-bands-" + to_string(getpid());
+#endif
+
+    SharedMemoryTransport* transport = SharedMemoryTransport::create(name, workers, width, height);
+
+    if (transport == nullptr)
+    {
+        cout << "Unable to create shared memory: " << name << endl;
+
+        return false;
+    }
+
+    bool success = spawnWorkers(executable, name);
+
+    // Even split to start with
+    bottom_.resize(workers);
+    top_.resize(workers);
+
+    for (int i = 0; i < workers; i++)
+    {
+        bottom_[i] = height * i / workers;
+        top_[i]    = height * (i + 1) / workers - 1;
+    }
+
+    glm::mat4 projection = glm::perspective(glm::radians(45.0f),
+                                            static_cast<float>(width) / height,
+                                            BAND_NEAR,
+                                            BAND_FAR);
+    vector<Light> lights = getDefaultLights();
+    vector<BandResult> results;
+
+    for (int i = 0; success && (i < settings_.frames); i++)
+    {
+        // Same framing as the window, going once around the scene
+        Camera    camera = Camera::turntable(i, settings_.frames);
+        BandFrame frame;
+        frame.viewProjection = projection * camera.getViewMatrix();
+        frame.eye            = camera.getPosition();
+        frame.viewDir        = camera.getFront();
+        frame.lightCount     = min(static_cast<int>(lights.size()), MAX_BAND_LIGHTS);
+        copy(lights.begin(), lights.begin() + frame.lightCount, frame.lights);
+        copy(bottom_.begin(), bottom_.end(), frame.bottom);
+        copy(top_.begin(), top_.end(), frame.top);
+
+        auto start = chrono::steady_clock::now();
+        transport->publishFrame(frame);
+
+        if (!transport->collectResults(results))
+        {
+            cout << "Band workers stopped answering at frame " << i << endl;
+            success = false;
+            break;
+        }
+
+        float frameTime = chrono::duration<float, milli>(chrono::steady_clock::now() - start).count();
+        float slowest   = 0.0f;
+
+        cout << "Frame " << i << ": " << frameTime << " ms, bands";
+
+        for (auto& result : results)
+        {
+            slowest = max(slowest, result.milliseconds);
+            cout << " " << result.bottom << "-" << result.top << " (" << result.milliseconds << " ms)";
+        }
+
+        cout << ", slowest " << slowest << " ms" << endl;
+
+        balanceBands(results);
+    }
+
+    if (success && !writeImagePPM(output, transport->getFramebuffer(), width, height))
+    {
+        cout << "Unable to write " << output << endl;
+        success = false;
+    }
+
+    transport->shutdown();
+    joinWorkers();
+    delete transport;
+
+    return success;
+}
+
+void BandRenderer::balanceBands(const vector<BandResult>& results)
+{
+    const int workers = settings_.workers;
+    const int height  = settings_.height;
+
+    vector<float> rowCost(height, 0.0f);
+    float total = 0.0f;
+
+    for (auto& result : results)
+    {
+        // Every worker transforms the whole scene, only drawing scales with the rows
+        int   rows = result.top - result.bottom + 1;
+        float cost = max(result.milliseconds - result.setupMilliseconds, BAND_MIN_MS) / max(rows, 1);
+
+        for (int row = max(result.bottom, 0); row <= min(result.top, height - 1); row++)
+        {
+            rowCost[row] = cost;
+            total       += cost;
+        }
+    }
+
+    // Cut where the running cost is closest to each share, at least one row each
+    float running = 0.0f;
+    int   bottom  = 0;
+
+    for (int i = 0; i < workers; i++)
+    {
+        int top = height - 1;
+
+        if (i < workers - 1)
+        {
+            float target  = total * (i + 1) / workers;
+            int   highest = height - workers + i;
+
+            top      = bottom;
+            running += rowCost[top];
+
+            while ((top < highest) && (running + rowCost[top + 1] * 0.5f < target))
+            {
+                running += rowCost[++top];
+            }
+        }
+
+        bottom_[i] = bottom;
+        top_[i]    = top;
+        bottom     = top + 1;
+    }
+}
+
+bool BandRenderer::spawnWorkers(const string& executable, const string& name)
+{
+    for (int i = 0; i < settings_.workers; i++)
+    {
+        vector<string> arguments = {
+            executable, "--band-worker", name, to_string(i), to_string(settings_.workers),
+            to_string(settings_.preset), to_string(settings_.width), to_string(settings_.height),
+            to_string(settings_.samples)
+        };
+
+#ifdef _WIN32
+        string commandLine;
+
+        for (auto& argument : arguments)
+        {
+            commandLine += "\"" + argument + "\" ";
+        }
+
+        STARTUPINFOA        startup = { sizeof(startup) };
+        PROCESS_INFORMATION process;
+
+        if (!CreateProcessA(nullptr, &commandLine[0], nullptr, nullptr, FALSE, 0, nullptr, nullptr, &startup, &process))
+        {
+            cout << "Unable to start band worker " << i << endl;
+
+            return false;
+        }
+
+        CloseHandle(process.hThread);
+        processes_.push_back(process.hProcess);
+#else
+        vector<char *> argv;
+
+        for (auto& argument : arguments)
+        {
+            argv.push_back(&argument[0]);
+        }
+
+        argv.push_back(nullptr);
+
+        pid_t process;
+
+        if (posix_spawnp(&process, executable.c_str(), nullptr, nullptr, argv.data(), environ) != 0)
+        {
+            cout << "Unable to start band worker " << i << endl;
+
+            return false;
+        }
+
+        processes_.push_back(process);
+#endif
+    }
+
+    return true;
+}
+
+void BandRenderer::joinWorkers()
+{
+    for (auto process : processes_)
+    {
+#ifdef _WIN32
+        WaitForSingleObject(process, INFINITE);
+        CloseHandle(process);
+#else
+        waitpid(process, nullptr, 0);
+#endif
+    }
+
+    processes_.clear();
+}
+
+int BandRenderer::runWorker(int argc, char** argv)
+{
+    if (argc < BAND_ARGUMENTS)
+    {
+        return 1;
+    }
+
+    string name    = argv[2];
+    int    worker  = atoi(argv[3]);
+    int    workers = atoi(argv[4]);
+    int    preset  = atoi(argv[5]);
+    int    width   = atoi(argv[6]);
+    int    height  = atoi(argv[7]);
+    int    samples = atoi(argv[8]);
+
+    SharedMemoryTransport* transport = SharedMemoryTransport::attach(name, worker, workers, width, height);
+
+    if (transport == nullptr)
+    {
+        cout << "Band worker " << worker << " unable to open shared memory: " << name << endl;
+
+        return 1;
+    }
+
+    // Every worker holds the whole scene, only its band is drawn
+    ResourceManager resourceManager;
+    SceneGraph      sceneGraph;
+    SceneNode     * scene = resourceManager.loadPreset(preset);
+
+    if (scene != nullptr)
+    {
+        sceneGraph.getRoot()->addChild(scene);
+    }
+
+    ZBufferScanLine scanLine(width, height, BAND_NEAR, BAND_FAR, samples);
+    scanLine.setVisibilityBuffer(true);
+    scanLine.setLighting(true);
+
+    BandFrame frame;
+
+    while (transport->receiveFrame(frame))
+    {
+        auto start = chrono::steady_clock::now();
+
+        scanLine.reset();
+        scanLine.setViewDir(frame.viewDir);
+        scanLine.setViewProjection(frame.viewProjection);
+        scanLine.setLights(vector<Light>(frame.lights, frame.lights + frame.lightCount), frame.eye);
+        sceneGraph.update(frame.viewProjection);
+
+        // Before inserting, polygons off the band are dropped
+        scanLine.setDirtyRegion(0, frame.bottom[worker], width - 1, frame.top[worker]);
+
+        for (SceneNode* node : sceneGraph.collectVisible())
+        {
+            DrawableObject* object = node->getDrawable();
+
+            scanLine.setMVP(node->getMVP());
+            scanLine.setModel(node->getWorldTransform());
+
+            // Offline frames are drawn at full detail
+            for (auto geometry : object->geometries)
+            {
+                scanLine.insertPolygons(geometry, object->useTexture);
+            }
+        }
+
+        auto drawStart = chrono::steady_clock::now();
+
+        scanLine.draw(transport->getFramebuffer());
+
+        BandResult result;
+        result.worker            = worker;
+        result.bottom            = frame.bottom[worker];
+        result.top               = frame.top[worker];
+        result.milliseconds      = chrono::duration<float, milli>(chrono::steady_clock::now() - start).count();
+        result.setupMilliseconds = chrono::duration<float, milli>(drawStart - start).count();
+        transport->submitResult(result);
+    }
+
+    delete transport;
+
+    return 0;
+}
@@ -0,0 +1,233 @@
+#include "BandTransport.h"
+
+#include <chrono>
+#include <cstring>
+#include <new>
+#include <thread>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+static_assert(ATOMIC_INT_LOCK_FREE == 2, "shared memory counters must be lock free");
+
+static const int BAND_SPINS      = 1000;   // Polls before sleeping between them
+static const int BAND_TIMEOUT_MS = 120000; // Workers load the scene before the first frame
+
+// Poll until ready() holds, false after the timeout
+template<typename Ready>
+static bool waitUntil(Ready ready)
+{
+    auto start = chrono::steady_clock::now();
+
+    for (int spin = 0; !ready(); spin++)
+    {
+        if (spin < BAND_SPINS)
+        {
+            this_thread::yield();
+            continue;
+        }
+
+        if (chrono::steady_clock::now() - start > chrono::milliseconds(BAND_TIMEOUT_MS))
+        {
+            return false;
+        }
+
+        this_thread::sleep_for(chrono::milliseconds(1));
+    }
+
+    return true;
+}
+
+SharedMemoryTransport::SharedMemoryTransport(const string& name, int worker, int workers, int width, int height) :
+    name_(name), worker_(worker), workers_(workers), width_(width), height_(height)
+{
+    size_ = getHeaderSize() + static_cast<size_t>(width) * height * 4;
+}
+
+SharedMemoryTransport::~SharedMemoryTransport()
+{
+#ifdef _WIN32
+    if (memory_ != nullptr)
+    {
+        UnmapViewOfFile(memory_);
+    }
+
+    if (handle_ != nullptr)
+    {
+        CloseHandle(handle_);
+    }
+#else
+    if (memory_ != nullptr)
+    {
+        munmap(memory_, size_);
+    }
+
+    // The name goes with the coordinator, mapped workers keep the memory
+    if (worker_ < 0)
+    {
+        shm_unlink(name_.c_str());
+    }
+#endif
+}
+
+size_t SharedMemoryTransport::getHeaderSize()
+{
+    // Framebuffer rows start on a cache line
+    return (sizeof(SharedHeader) + 63) / 64 * 64;
+}
+
+SharedMemoryTransport * SharedMemoryTransport::create(const string& name, int workers, int width, int height)
+{
+    SharedMemoryTransport* transport = new SharedMemoryTransport(name, -1, workers, width, height);
+
+    if (!transport->open(true))
+    {
+        delete transport;
+
+        return nullptr;
+    }
+
+    transport->header_ = new (transport->memory_) SharedHeader;
+    transport->header_->sequence = 0;
+    transport->header_->finished = 0;
+
+    return transport;
+}
+
+SharedMemoryTransport * SharedMemoryTransport::attach(const string& name, int worker, int workers, int width,
+                                                      int height)
+{
+    SharedMemoryTransport* transport = new SharedMemoryTransport(name, worker, workers, width, height);
+
+    if (!transport->open(false))
+    {
+        delete transport;
+
+        return nullptr;
+    }
+
+    transport->header_ = static_cast<SharedHeader *>(transport->memory_);
+
+    return transport;
+}
+
+bool SharedMemoryTransport::open(bool create)
+{
+#ifdef _WIN32
+    if (create)
+    {
+        handle_ = CreateFileMappingA(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE,
+                                     static_cast<DWORD>(static_cast<unsigned long long>(size_) >> 32),
+                                     static_cast<DWORD>(size_), name_.c_str());
+    }
+    else
+    {
+        handle_ = OpenFileMappingA(FILE_MAP_ALL_ACCESS, FALSE, name_.c_str());
+    }
+
+    if (handle_ == nullptr)
+    {
+        return false;
+    }
+
+    memory_ = MapViewOfFile(handle_, FILE_MAP_ALL_ACCESS, 0, 0, size_);
+#else
+    int file = shm_open(name_.c_str(), create ? O_CREAT | O_EXCL | O_RDWR : O_RDWR, 0600);
+
+    if (file < 0)
+    {
+        return false;
+    }
+
+    if (create && (ftruncate(file, static_cast<off_t>(size_)) != 0))
+    {
+        close(file);
+        shm_unlink(name_.c_str());
+
+        return false;
+    }
+
+    memory_ = mmap(nullptr, size_, PROT_READ | PROT_WRITE, MAP_SHARED, file, 0);
+    close(file);
+
+    if (memory_ == MAP_FAILED)
+    {
+        memory_ = nullptr;
+    }
+#endif
+
+    if (memory_ == nullptr)
+    {
+        return false;
+    }
+
+    framebuffer_ = static_cast<GLubyte *>(memory_) + getHeaderSize();
+
+    return true;
+}
+
+void SharedMemoryTransport::publishFrame(const BandFrame& frame)
+{
+    // Every worker finished the last frame, nobody reads the header now
+    header_->frame          = frame;
+    header_->frame.sequence = ++lastSequence_;
+    header_->finished.store(0, memory_order_relaxed);
+    header_->sequence.store(lastSequence_, memory_order_release);
+}
+
+bool SharedMemoryTransport::collectResults(vector<BandResult>& results)
+{
+    if (!waitUntil([this]() {
+                       return header_->finished.load(memory_order_acquire) == workers_;
+                   }))
+    {
+        return false;
+    }
+
+    results.assign(header_->results, header_->results + workers_);
+
+    return true;
+}
+
+void SharedMemoryTransport::shutdown()
+{
+    header_->sequence.store(-1, memory_order_release);
+}
+
+bool SharedMemoryTransport::receiveFrame(BandFrame& frame)
+{
+    int sequence = 0;
+
+    if (!waitUntil([this, &sequence]() {
+                       sequence = header_->sequence.load(memory_order_acquire);
+
+                       return (sequence < 0) || (sequence > lastSequence_);
+                   }))
+    {
+        return false;
+    }
+
+    if (sequence < 0)
+    {
+        return false;
+    }
+
+    frame         = header_->frame;
+    lastSequence_ = sequence;
+
+    return true;
+}
+
+void SharedMemoryTransport::submitResult(const BandResult& result)
+{
+    header_->results[worker_] = result;
+    header_->finished.fetch_add(1, memory_order_release);
+}
@@ -0,0 +1,148 @@
+#include "BatchRenderer.h"
+
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <algorithm>
+#include <chrono>
+using namespace std;
+
+#include "Camera.h"
+#include "ResourceManager.h"
+#include "TaskScheduler.h"
+#include "ZBufferScanLine.h"
+
+static const int BANDS_PER_SLOT = 2; // Bands of a split view per scheduler slot, for balance
+
+BatchRenderer::BatchRenderer(SceneGraph& scene, float near, float far) :
+    scene_(scene), near_(near), far_(far), lights_(getDefaultLights())
+{}
+
+BatchRenderer::~BatchRenderer()
+{
+    for (auto context : contexts_)
+    {
+        delete context;
+    }
+}
+
+void BatchRenderer::render(vector<BatchView>& views)
+{
+    // Transforms and bounds once, views only read the graph afterwards
+    scene_.update(glm::mat4(1.0f));
+
+    TaskScheduler& scheduler = TaskScheduler::shared();
+
+    int slots = scheduler.getSlotCount();
+
+    contexts_.resize(slots, nullptr);
+    visible_.resize(slots);
+
+    // Too few views to keep every slot busy, the rows of each view are
+    // split into bands drawn like the band worker processes draw theirs
+    int viewCount = static_cast<int>(views.size());
+    int bands     = ((viewCount > 0) && (viewCount < slots)) ? BANDS_PER_SLOT * slots / viewCount : 1;
+
+    for (auto& view : views)
+    {
+        view.image.resize(view.width * view.height * 4);
+    }
+
+    auto start = chrono::steady_clock::now();
+
+    // Whole views or bands of them per task, they are independent
+    auto drawViews = [this, &views, &scheduler, bands](int first, int last) {
+                         int               slot    = scheduler.getSlot();
+                         ZBufferScanLine*& context = contexts_[slot];
+
+                         for (int i = first; i < last; i++)
+                         {
+                             BatchView& view   = views[i / bands];
+                             int        band   = i % bands;
+                             int        bottom = band * view.height / bands;
+                             int        top    = (band + 1) * view.height / bands - 1;
+
+                             if (bottom > top)
+                             {
+                                 continue;
+                             }
+
+                             if (context == nullptr)
+                             {
+                                 context = new ZBufferScanLine(view.width, view.height, near_, far_, view.samples);
+                                 context->setLighting(true);
+                             }
+                             else if ((context->getWidth() != view.width) || (context->getHeight() != view.height) ||
+                                      (context->getSamples() != view.samples))
+                             {
+                                 context->resize(view.width, view.height, view.samples);
+                             }
+
+                             renderView(view, *context, visible_[slot], bottom, top);
+                         }
+                     };
+
+    scheduler.parallelFor(0, viewCount * bands, 1, drawViews);
+
+    float seconds = chrono::duration<float>(chrono::steady_clock::now() - start).count();
+
+    viewsPerSecond_ = views.size() / max(seconds, 1e-6f);
+}
+
+void BatchRenderer::renderView(BatchView& view, ZBufferScanLine& context, vector<SceneNode *>& visible, int bottom,
+                               int top)
+{
+    glm::mat4 viewProjection = view.projection * view.view;
+    glm::mat4 camera         = glm::inverse(view.view);
+
+    context.reset();
+    context.setViewDir(-glm::vec3(camera[2]));
+    context.setViewProjection(viewProjection);
+    context.setLights(lights_, glm::vec3(camera[3]));
+
+    // Before inserting, polygons off the band are dropped
+    if ((bottom > 0) || (top < view.height - 1))
+    {
+        context.setDirtyRegion(0, bottom, view.width - 1, top);
+    }
+    else
+    {
+        context.clearDirtyRegion();
+    }
+
+    // Node MVPs of the graph belong to the window, each view has its own
+    scene_.collectVisible(viewProjection, visible);
+
+    for (SceneNode* node : visible)
+    {
+        DrawableObject* object = node->getDrawable();
+
+        context.setMVP(viewProjection * node->getWorldTransform());
+        context.setModel(node->getWorldTransform());
+
+        for (auto geometry : object->geometries)
+        {
+            context.insertPolygons(geometry, object->useTexture);
+        }
+    }
+
+    context.draw(view.image.data());
+}
+
+vector<BatchView> BatchRenderer::makeTurntable(int count, int width, int height, int samples, float elevation) const
+{
+    vector<BatchView> views(count);
+    glm::mat4 projection = glm::perspective(glm::radians(45.0f), static_cast<float>(width) / height, near_, far_);
+
+    for (int i = 0; i < count; i++)
+    {
+        Camera camera = Camera::turntable(i, count, elevation);
+
+        views[i].view       = camera.getViewMatrix();
+        views[i].projection = projection;
+        views[i].width      = width;
+        views[i].height     = height;
+        views[i].samples    = samples;
+    }
+
+    return views;
+}
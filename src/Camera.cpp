@@ -66,6 +66,11 @@ Camera::Camera(GLfloat   angleH,
     this->updateCameraVectors();
 }
 
+Camera Camera::turntable(int index, int count, GLfloat angleV)
+{
+    return Camera(90.0f + 360.0f * index / count, angleV, 50.0f);
+}
+
 // Processes input received from any keyboard-like input system.
 // Accepts input parameter in the form of camera_ defined ENUM (to abstract it from windowing systems)
 void Camera::processKeyboard(CameraMovement direction, GLfloat deltaTime)
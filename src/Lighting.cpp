@@ -0,0 +1,206 @@
+#include "Lighting.h"
+
+#include <algorithm>
+#include <cmath>
+using namespace std;
+
+#include "HelperTools.h"
+
+void GBufferLine::resize(int width)
+{
+    if (covered.size() < width)
+    {
+        normalX.resize(width);
+        normalY.resize(width);
+        normalZ.resize(width);
+        positionX.resize(width);
+        positionY.resize(width);
+        positionZ.resize(width);
+        covered.resize(width);
+    }
+}
+
+void LightingPass::shadeLine(GLubyte* color, const GBufferLine& gBuffer, int begin, int end)
+{
+    int x = begin;
+
+#ifdef USE_SSE2
+    const __m128  zero      = _mm_setzero_ps();
+    const __m128  one       = _mm_set1_ps(1.0f);
+    const __m128  tiny      = _mm_set1_ps(1e-12f);
+    const __m128  maxColor  = _mm_set1_ps(255.0f);
+    const __m128  ambient   = _mm_set1_ps(ambient_);
+    const __m128  shininess = _mm_set1_ps(shininess_);
+    const __m128i byteMask  = _mm_set1_epi32(0xff);
+    const __m128i alpha     = _mm_set1_epi32(0xff000000);
+
+    for (; x + 4 <= end; x += 4)
+    {
+        __m128i mask = _mm_loadu_si128(reinterpret_cast<const __m128i *>(&gBuffer.covered[x]));
+
+        if (_mm_movemask_epi8(mask) == 0)
+        {
+            continue;
+        }
+
+        // Surface
+        __m128 nx  = _mm_loadu_ps(&gBuffer.normalX[x]);
+        __m128 ny  = _mm_loadu_ps(&gBuffer.normalY[x]);
+        __m128 nz  = _mm_loadu_ps(&gBuffer.normalZ[x]);
+        __m128 len = _mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, nx), _mm_mul_ps(ny, ny)), _mm_mul_ps(nz, nz));
+        __m128 inv = _mm_div_ps(one, _mm_sqrt_ps(_mm_max_ps(len, tiny)));
+        nx = _mm_mul_ps(nx, inv);
+        ny = _mm_mul_ps(ny, inv);
+        nz = _mm_mul_ps(nz, inv);
+
+        __m128 px = _mm_loadu_ps(&gBuffer.positionX[x]);
+        __m128 py = _mm_loadu_ps(&gBuffer.positionY[x]);
+        __m128 pz = _mm_loadu_ps(&gBuffer.positionZ[x]);
+
+        __m128 vx = _mm_sub_ps(_mm_set1_ps(eye_.x), px);
+        __m128 vy = _mm_sub_ps(_mm_set1_ps(eye_.y), py);
+        __m128 vz = _mm_sub_ps(_mm_set1_ps(eye_.z), pz);
+        len = _mm_add_ps(_mm_add_ps(_mm_mul_ps(vx, vx), _mm_mul_ps(vy, vy)), _mm_mul_ps(vz, vz));
+        inv = _mm_div_ps(one, _mm_sqrt_ps(_mm_max_ps(len, tiny)));
+        vx  = _mm_mul_ps(vx, inv);
+        vy  = _mm_mul_ps(vy, inv);
+        vz  = _mm_mul_ps(vz, inv);
+
+        // Accumulated light per channel, in BGR order
+        __m128 diffuseB  = ambient;
+        __m128 diffuseG  = ambient;
+        __m128 diffuseR  = ambient;
+        __m128 specularB = zero;
+        __m128 specularG = zero;
+        __m128 specularR = zero;
+
+        for (const Light& light : lights_)
+        {
+            __m128 lx;
+            __m128 ly;
+            __m128 lz;
+            __m128 intensity = one;
+
+            if (light.type == DIRECTIONAL_LIGHT)
+            {
+                glm::vec3 dir = -glm::normalize(light.position);
+                lx = _mm_set1_ps(dir.x);
+                ly = _mm_set1_ps(dir.y);
+                lz = _mm_set1_ps(dir.z);
+            }
+            else
+            {
+                lx  = _mm_sub_ps(_mm_set1_ps(light.position.x), px);
+                ly  = _mm_sub_ps(_mm_set1_ps(light.position.y), py);
+                lz  = _mm_sub_ps(_mm_set1_ps(light.position.z), pz);
+                len = _mm_add_ps(_mm_add_ps(_mm_mul_ps(lx, lx), _mm_mul_ps(ly, ly)), _mm_mul_ps(lz, lz));
+                inv = _mm_div_ps(one, _mm_sqrt_ps(_mm_max_ps(len, tiny)));
+                lx  = _mm_mul_ps(lx, inv);
+                ly  = _mm_mul_ps(ly, inv);
+                lz  = _mm_mul_ps(lz, inv);
+
+                intensity = _mm_div_ps(one, _mm_add_ps(one, _mm_mul_ps(_mm_set1_ps(light.attenuation), len)));
+            }
+
+            __m128 nDotL = _mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, lx), _mm_mul_ps(ny, ly)), _mm_mul_ps(nz, lz));
+            __m128 lit   = _mm_cmpgt_ps(nDotL, zero);
+
+            // Half vector
+            __m128 hx = _mm_add_ps(lx, vx);
+            __m128 hy = _mm_add_ps(ly, vy);
+            __m128 hz = _mm_add_ps(lz, vz);
+            len = _mm_add_ps(_mm_add_ps(_mm_mul_ps(hx, hx), _mm_mul_ps(hy, hy)), _mm_mul_ps(hz, hz));
+            inv = _mm_div_ps(one, _mm_sqrt_ps(_mm_max_ps(len, tiny)));
+
+            __m128 nDotH = _mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, hx), _mm_mul_ps(ny, hy)), _mm_mul_ps(nz, hz));
+            nDotH = _mm_max_ps(_mm_mul_ps(nDotH, inv), zero);
+
+            // Schlick's approximation of pow(nDotH, shininess)
+            __m128 spec = _mm_div_ps(nDotH, _mm_add_ps(_mm_sub_ps(shininess, _mm_mul_ps(shininess, nDotH)), nDotH));
+            spec = _mm_and_ps(lit, _mm_mul_ps(spec, _mm_mul_ps(intensity, _mm_set1_ps(specular_))));
+
+            __m128 diffuse = _mm_and_ps(lit, _mm_mul_ps(nDotL, intensity));
+
+            diffuseB  = _mm_add_ps(diffuseB,  _mm_mul_ps(diffuse, _mm_set1_ps(light.color.b)));
+            diffuseG  = _mm_add_ps(diffuseG,  _mm_mul_ps(diffuse, _mm_set1_ps(light.color.g)));
+            diffuseR  = _mm_add_ps(diffuseR,  _mm_mul_ps(diffuse, _mm_set1_ps(light.color.r)));
+            specularB = _mm_add_ps(specularB, _mm_mul_ps(spec,    _mm_set1_ps(light.color.b)));
+            specularG = _mm_add_ps(specularG, _mm_mul_ps(spec,    _mm_set1_ps(light.color.g)));
+            specularR = _mm_add_ps(specularR, _mm_mul_ps(spec,    _mm_set1_ps(light.color.r)));
+        }
+
+        // Modulate the BGRA albedo
+        __m128i pixels = _mm_loadu_si128(reinterpret_cast<__m128i *>(color + x * 4));
+        __m128  b      = _mm_cvtepi32_ps(_mm_and_si128(pixels, byteMask));
+        __m128  g      = _mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(pixels, 8), byteMask));
+        __m128  r      = _mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(pixels, 16), byteMask));
+
+        b = _mm_min_ps(_mm_add_ps(_mm_mul_ps(b, diffuseB), _mm_mul_ps(specularB, maxColor)), maxColor);
+        g = _mm_min_ps(_mm_add_ps(_mm_mul_ps(g, diffuseG), _mm_mul_ps(specularG, maxColor)), maxColor);
+        r = _mm_min_ps(_mm_add_ps(_mm_mul_ps(r, diffuseR), _mm_mul_ps(specularR, maxColor)), maxColor);
+
+        __m128i shaded = _mm_or_si128(_mm_or_si128(_mm_cvttps_epi32(b),
+                                                   _mm_slli_epi32(_mm_cvttps_epi32(g), 8)),
+                                      _mm_or_si128(_mm_slli_epi32(_mm_cvttps_epi32(r), 16), alpha));
+
+        shaded = _mm_or_si128(_mm_and_si128(mask, shaded), _mm_andnot_si128(mask, pixels));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(color + x * 4), shaded);
+    }
+#endif
+
+    for (; x < end; x++)
+    {
+        if (gBuffer.covered[x] != 0)
+        {
+            shadePixel(color + x * 4, gBuffer, x);
+        }
+    }
+}
+
+void LightingPass::shadePixel(GLubyte* color, const GBufferLine& gBuffer, int x)
+{
+    glm::vec3 normal   = glm::normalize(glm::vec3(gBuffer.normalX[x], gBuffer.normalY[x], gBuffer.normalZ[x]));
+    glm::vec3 position = glm::vec3(gBuffer.positionX[x], gBuffer.positionY[x], gBuffer.positionZ[x]);
+    glm::vec3 view     = glm::normalize(eye_ - position);
+    glm::vec3 diffuse  = glm::vec3(ambient_);
+    glm::vec3 specular = glm::vec3(0.0f);
+
+    for (const Light& light : lights_)
+    {
+        glm::vec3 dir;
+        float     intensity = 1.0f;
+
+        if (light.type == DIRECTIONAL_LIGHT)
+        {
+            dir = -glm::normalize(light.position);
+        }
+        else
+        {
+            dir = light.position - position;
+
+            float distance2 = glm::dot(dir, dir);
+            dir      /= sqrt(std::max(distance2, 1e-12f));
+            intensity = 1.0f / (1.0f + light.attenuation * distance2);
+        }
+
+        float nDotL = glm::dot(normal, dir);
+
+        if (nDotL <= 0.0f)
+        {
+            continue;
+        }
+
+        glm::vec3 half  = dir + view;
+        float     nDotH = std::max(glm::dot(normal, half) / sqrt(std::max(glm::dot(half, half), 1e-12f)), 0.0f);
+        float     spec  = nDotH / (shininess_ - shininess_ * nDotH + nDotH);
+
+        diffuse  += light.color * (nDotL * intensity);
+        specular += light.color * (spec * intensity * specular_);
+    }
+
+    // BGRA
+    color[0] = static_cast<GLubyte>(std::min(color[0] * diffuse.b + specular.b * 255.0f, 255.0f));
+    color[1] = static_cast<GLubyte>(std::min(color[1] * diffuse.g + specular.g * 255.0f, 255.0f));
+    color[2] = static_cast<GLubyte>(std::min(color[2] * diffuse.r + specular.r * 255.0f, 255.0f));
+    color[3] = 255;
+}
@@ -1,7 +1,132 @@
 #include "MainWindow.h"
+#include "BandRenderer.h"
+#include "BatchRenderer.h"
+#include "ImageWriter.h"
+#include "StereoRenderer.h"
+
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <cstdio>
+#include <cstring>
 
 int main(int argc, char* argv[])
 {
+    // Started by a band render below
+    if ((argc > 1) && (strcmp(argv[1], "--band-worker") == 0))
+    {
+        return BandRenderer::runWorker(argc, argv);
+    }
+
+    // Offline frames drawn in bands by worker processes
+    if ((argc > 1) && (strcmp(argv[1], "--bands") == 0))
+    {
+        BandRenderer::Settings settings;
+
+        if (argc > 2) settings.preset = atoi(argv[2]);
+        if (argc > 3) settings.workers = atoi(argv[3]);
+        if (argc > 4) settings.frames = atoi(argv[4]);
+        if (argc > 7) settings.samples = atoi(argv[7]);
+
+        if (argc > 6)
+        {
+            settings.width  = atoi(argv[5]);
+            settings.height = atoi(argv[6]);
+        }
+
+        BandRenderer renderer(settings);
+
+        return renderer.render(argv[0], "bands.ppm") ? 0 : 1;
+    }
+
+    // Turntable of a model, every view written out
+    if ((argc > 1) && (strcmp(argv[1], "--views") == 0))
+    {
+        int preset  = argc > 2 ? atoi(argv[2]) : 0;
+        int count   = argc > 3 ? atoi(argv[3]) : 36;
+        int width   = argc > 5 ? atoi(argv[4]) : 256;
+        int height  = argc > 5 ? atoi(argv[5]) : 256;
+        int samples = argc > 6 ? atoi(argv[6]) : 2;
+
+        ResourceManager resourceManager;
+        SceneGraph      scene;
+        SceneNode     * model = resourceManager.loadPreset(preset);
+
+        if (model == nullptr)
+        {
+            return 1;
+        }
+
+        scene.getRoot()->addChild(model);
+
+        BatchRenderer     renderer(scene);
+        vector<BatchView> views = renderer.makeTurntable(count, width, height, samples);
+        renderer.render(views);
+
+        std::cout << views.size() << " views, " << renderer.getViewsPerSecond() << " views/s" << std::endl;
+
+        for (int i = 0; i < views.size(); i++)
+        {
+            char name[32];
+            snprintf(name, sizeof(name), "view%03d.ppm", i);
+            writeImagePPM(name, views[i].image.data(), views[i].width, views[i].height);
+        }
+
+        return 0;
+    }
+
+    // Both eyes of an orbit in one pass, the pair of the last frame written out
+    if ((argc > 1) && (strcmp(argv[1], "--stereo") == 0))
+    {
+        int preset  = argc > 2 ? atoi(argv[2]) : 0;
+        int frames  = argc > 3 ? atoi(argv[3]) : 36;
+        int width   = argc > 5 ? atoi(argv[4]) : 640;
+        int height  = argc > 5 ? atoi(argv[5]) : 480;
+        int samples = argc > 6 ? atoi(argv[6]) : 2;
+
+        ResourceManager resourceManager;
+        SceneGraph      scene;
+        SceneNode     * model = resourceManager.loadPreset(preset);
+
+        if (model == nullptr)
+        {
+            return 1;
+        }
+
+        scene.getRoot()->addChild(model);
+
+        StereoRenderer  renderer(scene, width, height, samples);
+        vector<GLubyte> left(width * height * 4);
+        vector<GLubyte> right(width * height * 4);
+        glm::mat4       projection = glm::perspective(glm::radians(45.0f), static_cast<float>(width) / height, 0.1f, 100.0f);
+        float           frameMs    = 0.0f;
+        float           saved      = 0.0f;
+
+        for (int i = 0; i < frames; i++)
+        {
+            Camera camera = Camera::turntable(i, frames);
+
+            renderer.render(camera.getViewMatrix(), projection, left.data(), right.data());
+
+            frameMs += renderer.getStatistics().frameMs;
+            saved   += renderer.getStatistics().getSavedFraction();
+        }
+
+        frames = std::max(frames, 1);
+
+        std::cout << frameMs / frames << " ms per pair, " << 100.0f * saved / frames << "% of the second eye shared" << std::endl;
+
+        // Side by side, left eye first
+        vector<GLubyte> pair(width * height * 8);
+
+        for (int y = 0; y < height; y++)
+        {
+            std::copy(left.begin() + y * width * 4, left.begin() + (y + 1) * width * 4, pair.begin() + y * width * 8);
+            std::copy(right.begin() + y * width * 4, right.begin() + (y + 1) * width * 4, pair.begin() + y * width * 8 + width * 4);
+        }
+
+        return writeImagePPM("stereo.ppm", pair.data(), width * 2, height) ? 0 : 1;
+    }
+
     MainWindow window;
 
     if (argc > 1)
@@ -9,6 +134,18 @@ int main(int argc, char* argv[])
         window.setMode(atoi(argv[1]));
     }
 
+    // Worker threads, and whether to pin them to cores
+    if (argc > 2)
+    {
+        window.setWorkers(atoi(argv[2]), (argc > 3) && (atoi(argv[3]) != 0));
+    }
+
+    // Frames in flight
+    if (argc > 4)
+    {
+        window.setPipelineDepth(atoi(argv[4]));
+    }
+
     window.init();
 
     window.gameLoop();
@@ -2,13 +2,19 @@
 
 #include <glm/gtc/matrix_transform.hpp>
 
+#include <algorithm>
+#include <cmath>
+#include <cstring>
 #include <thread> // std::this_thread::sleep_for
 #include <chrono> // std::chrono::seconds
 using namespace std;
 
 #include "ZBufferScanLine.h"
+#include "TileRasterizer.h"
 #include "Shader.h"
 
+static const int BANDS_PER_SLOT = 2; // Bands of a scanline frame per scheduler slot, for balance
+
 MainWindow * MainWindow::instance_ = nullptr;
 bool   MainWindow::keys_[1024];
 double MainWindow::lastX_        = 400;
@@ -17,6 +23,7 @@ bool   MainWindow::firstMouse_   = true;
 bool   MainWindow::leftPushed_   = false;
 bool   MainWindow::rightPushed_  = false;
 bool   MainWindow::isRendering_  = true;
+bool   MainWindow::redraw_       = false;
 float  MainWindow::deltaTime_    = 0.0;
 float  MainWindow::currentFrame_ = 0.0;
 float  MainWindow::lastFrame_    = 0.0;
@@ -24,20 +31,17 @@ float  MainWindow::timerFrame_;
 int    MainWindow::showModel_ = 0;
 
 MainWindow::MainWindow() :
-    camera_(90.0f, 0.0f, 50.0f)
+    camera_(90.0f, 0.0f, 50.0f),
+    governor_(frameBudget_, minScale_, progressive_ ? 1 : samples_)
 {
-    instance_         = this;
-    scanLine_         = new ZBufferScanLine(textureWidth_, textureHeight_, nearPlane_, farPlane_);
-    textureImages_[0] = new GLubyte[bufferSize_];
-    textureImages_[1] = new GLubyte[bufferSize_];
+    instance_ = this;
+    createFrames();
 }
 
 MainWindow::~MainWindow()
 {
-    delete scanLine_;
+    destroyFrames();
     delete screenShader_;
-    delete[] textureImages_[0];
-    delete[] textureImages_[1];
 
     // clean up texture
     glDeleteTextures(1, &screenTexture_);
@@ -46,6 +50,81 @@ MainWindow::~MainWindow()
     glDeleteBuffersARB(2, PBOs_);
 }
 
+void MainWindow::createFrames()
+{
+    // Consecutive frames alternate contexts, interlacing continues across them
+    interlaceHistory_ = new InterlaceHistory;
+
+    for (int i = 0; i < pipelineDepth_; i++)
+    {
+        FrameContext* frame   = new FrameContext;
+        frame->scanLine       = new ZBufferScanLine(textureWidth_, textureHeight_, nearPlane_, farPlane_, rasterSamples_);
+        frame->tileRasterizer = new TileRasterizer(textureWidth_, textureHeight_, nearPlane_, farPlane_, rasterSamples_);
+        frame->image          = new GLubyte[bufferSize_];
+        frame->scanLine->setHistory(interlaceHistory_);
+        frames_.push_back(frame);
+    }
+
+    // Band contexts are created by the slot that first draws on them
+    bandContexts_.assign(TaskScheduler::shared().getSlotCount(), nullptr);
+
+    nextFrame_ = 0;
+    bindFrame(*frames_[0]);
+}
+
+void MainWindow::destroyFrames()
+{
+    // Frames still rastering write into their contexts
+    for (FrameContext* frame : inFlight_)
+    {
+        TaskScheduler::shared().wait(frame->raster);
+    }
+
+    for (FrameContext* frame : frames_)
+    {
+        delete frame->scanLine;
+        delete frame->tileRasterizer;
+        delete[] frame->image;
+        delete frame;
+    }
+
+    for (ZBufferScanLine* band : bandContexts_)
+    {
+        delete band;
+    }
+
+    delete interlaceHistory_;
+
+    interlaceHistory_ = nullptr;
+    bandContexts_.clear();
+    frames_.clear();
+    inFlight_.clear();
+    latest_        = nullptr;
+    presented_     = nullptr;
+    frameReusable_ = false;
+}
+
+void MainWindow::bindFrame(FrameContext& frame)
+{
+    scanLine_       = frame.scanLine;
+    tileRasterizer_ = frame.tileRasterizer;
+    rasterizer_     = useTileRasterizer_ ? static_cast<Rasterizer *>(tileRasterizer_) : scanLine_;
+    frame.rasterizer = rasterizer_;
+
+    // Settings changed while the context was in flight are applied now
+    scanLine_->setVisibilityBuffer(visibilityBuffer_);
+    scanLine_->setInterlacing(interlace_);
+    scanLine_->setBilinearFilter(bilinearFilter_);
+    scanLine_->setLighting(lighting_);
+    tileRasterizer_->setLighting(lighting_);
+
+    if ((rasterizer_->getWidth() != rasterWidth_) || (rasterizer_->getHeight() != rasterHeight_) ||
+        (rasterizer_->getSamples() != rasterSamples_))
+    {
+        rasterizer_->resize(rasterWidth_, rasterHeight_, rasterSamples_);
+    }
+}
+
 void MainWindow::init()
 {
     initOpenGL();
@@ -129,13 +208,28 @@ void MainWindow::gameLoop()
 
         if (currentFrame_ - tick > 0.5f)
         {
+            // The frame on screen, its context is not in flight at this point
+            FrameContext* shown      = presented_ != nullptr ? presented_ : frames_[0];
+            Rasterizer  * rasterizer = shown->rasterizer;
+
             tick = currentFrame_;
             printf("%c[2K", 27);
             cout << "\r"
-                 << "Polygons: " << scanLine_->getNumPolygon() << "\t"
+                 << "Backend: " << rasterizer->getName() << "\t"
+                 << "Polygons: " << shown->polygons << "\t"
+                 << "Resolution: " << shown->width << "x" << shown->height
+                 << " x" << rasterizer->getSamples() << "\t"
+                 << "Lighting: " << shown->lightingTime << " ms\t"
                  << "FPS: " << count * 2;
 
             if (!isRendering_) cout << " (puased)";
+            if ((rasterizer == shown->scanLine) && shown->scanLine->isInterlacedFrame()) cout << " (interlaced)";
+            if (progressive_ && (refineLevel_ == REFINE_SAMPLES)) cout << " (refined)";
+            if (resourceManager_.getStreamingCount() > 0) cout << " (streaming " << resourceManager_.getStreamingCount() << ")";
+
+            TaskStatistics tasks = TaskScheduler::shared().getStatistics();
+            cout << "\tTasks: " << tasks.executed << " (" << tasks.stolen << " stolen, queue " << tasks.maxQueued << ")";
+            TaskScheduler::shared().resetStatistics();
             count = 0;
         }
 
@@ -156,9 +250,48 @@ void MainWindow::gameLoop()
         doMovement();
         viewMatrix_ = camera_.getViewMatrix();
 
+        if (animate_ && !sceneGraph_.getRoot()->getChildren().empty())
+        {
+            SceneNode* model = sceneGraph_.getRoot()->getChildren().front();
+            model->setLocalTransform(glm::rotate(model->getLocalTransform(), deltaTime_, glm::vec3(0.0f, 1.0f, 0.0f)));
+        }
+
+        // Streamed models and textures swap in between frames, while none
+        // is in flight, and the final image has to be drawn again
+        if (resourceManager_.hasStreamed())
+        {
+            finishFrames();
+            resourceManager_.commitStreamed();
+            redraw_ = true;
+        }
+
+        // Nothing to draw once the final image is on screen
+        if (!refineFrame())
+        {
+            // It may still be in the pipeline, then waiting in the PBO
+            finishFrames();
+
+            if (uploadPending_)
+            {
+                uploadTexture();
+                drawToScreen();
+                glfwSwapBuffers(window_);
+            }
+
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            continue;
+        }
+
         // Main rendering
+        float renderStart = static_cast<float>(glfwGetTime());
         drawToPBO();
 
+        // Refinement frames are allowed to exceed the budget, partial ones say nothing about it
+        if ((refineLevel_ == REFINE_MOVING) && !partialFrame_)
+        {
+            updateResolution((static_cast<float>(glfwGetTime()) - renderStart) * 1000.0f);
+        }
+
         // Draw texture to screen
         drawToScreen();
 
@@ -170,26 +303,303 @@ void MainWindow::gameLoop()
 
 void MainWindow::drawToPBO()
 {
-    // TODO: I used double PBO here, but it won't benefit unless there's a seperate render thread
-    static int index = 0;
-    int nextIndex    = 0; // pbo index used for next frame
+    // The frame presented last -> texture
+    if (uploadPending_)
+    {
+        uploadTexture();
+    }
 
-    // index = (index + 1) % 2;
-    // nextIndex = (index + 1) % 2;
+    FrameContext& frame = *frames_[nextFrame_];
+    nextFrame_ = (nextFrame_ + 1) % frames_.size();
+
+    // Setup runs here while the frames in flight rasterize
+    bindFrame(frame);
+    prepareScene();
 
-    // bind the texture
+    frame.width   = renderWidth_;
+    frame.height  = renderHeight_;
+    frame.partial = partialFrame_;
+    frame.rect    = dirtyRect_;
+    frame.pass    = framePass_;
+    frame.banded  = bandedFrame_;
+
+    // Bands insert the scene on the workers, with the camera of this frame
+    frame.draws.swap(sceneDraws_);
+    frame.viewDir        = camera_.getFront();
+    frame.eye            = camera_.getPosition();
+    frame.viewProjection = projectionMatrix_ * viewMatrix_;
+
+    // A partial frame draws over the newest image, which another context may hold
+    if (frame.partial)
+    {
+        finishFrames();
+
+        if ((latest_ != nullptr) && (latest_ != &frame))
+        {
+            memcpy(frame.image, latest_->image, renderWidth_ * renderHeight_ * 4);
+        }
+    }
+
+    // Scanline frames continue the interlace history of those before, so
+    // their raster waits for them. Only the setup above overlapped it
+    if (rasterizer_ == scanLine_)
+    {
+        for (FrameContext* other : inFlight_)
+        {
+            if ((other->rasterizer == other->scanLine) &&
+                (scanLine_->getInterlacing() || other->scanLine->getInterlacing()))
+            {
+                finishFrames();
+                break;
+            }
+        }
+    }
+
+    // Half of an interlaced frame is rebuilt from the one before, a partial
+    // redraw over it would keep that guess once the camera stops
+    bool interlaced = !bandedFrame_ && (rasterizer_ == scanLine_) && scanLine_->willInterlace();
+
+    TaskScheduler::shared().submit(frame.raster, [this, &frame]() {
+                                       renderScene(frame);
+                                   });
+    inFlight_.push_back(&frame);
+    latest_        = &frame;
+    frameReusable_ = !interlaced;
+
+    // Bounded latency: the context set up next must be free
+    if (inFlight_.size() >= frames_.size())
+    {
+        presentFrame();
+    }
+}
+
+void MainWindow::presentFrame()
+{
+    FrameContext& frame = *inFlight_.front();
+
+    inFlight_.pop_front();
+    TaskScheduler::shared().wait(frame.raster);
+
+    if (frame.pass >= 0)
+    {
+        accumulateFrame(frame);
+    }
+
+    // Partial frames only update the texture where they changed, so it must
+    // have seen the frame before
+    if (uploadPending_)
+    {
+        uploadTexture();
+    }
+
+    // CPU -> PBO
+    glBindBufferARB(GL_PIXEL_UNPACK_BUFFER_ARB, PBOs_[0]);
+
+    if (frame.partial)
+    {
+        // Only the rows of the redrawn rectangle changed
+        int offset = frame.rect.y * frame.width * 4;
+        int size   = (frame.rect.w - frame.rect.y + 1) * frame.width * 4;
+
+        if (size > 0)
+        {
+            glBufferSubDataARB(GL_PIXEL_UNPACK_BUFFER_ARB, offset, size, frame.image + offset);
+        }
+    }
+    else
+    {
+        glBufferDataARB(GL_PIXEL_UNPACK_BUFFER_ARB, frame.width * frame.height * 4, frame.image, GL_STREAM_DRAW_ARB);
+    }
+
+    uploadWidth_   = frame.width;
+    uploadHeight_  = frame.height;
+    uploadPending_ = true;
+    uploadPartial_ = frame.partial;
+    uploadRect_    = frame.rect;
+    presented_     = &frame;
+}
+
+void MainWindow::finishFrames()
+{
+    while (!inFlight_.empty())
+    {
+        presentFrame();
+    }
+}
+
+void MainWindow::uploadTexture()
+{
+    // bind the texture (the PBO still holds the last frame, at its own size)
     glBindTexture(GL_TEXTURE_2D, screenTexture_);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, textureWidth_, textureHeight_, 0, GL_BGRA, GL_UNSIGNED_INT_8_8_8_8_REV, 0);
 
-    // First PBO -> screen
-    // glBindBufferARB(GL_PIXEL_UNPACK_BUFFER_ARB, PBOs_[index]);
-    // glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, textureWidth_, textureHeight_, GL_BGRA, GL_UNSIGNED_INT_8_8_8_8_REV, 0);
+    if (!uploadPartial_)
+    {
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, uploadWidth_, uploadHeight_, 0, GL_BGRA, GL_UNSIGNED_INT_8_8_8_8_REV, 0);
+    }
+    else if ((uploadRect_.x <= uploadRect_.z) && (uploadRect_.y <= uploadRect_.w))
+    {
+        // The rest of the texture is still the frame before
+        size_t offset = (static_cast<size_t>(uploadRect_.y) * uploadWidth_ + uploadRect_.x) * 4;
+
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, uploadWidth_);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, uploadRect_.x, uploadRect_.y,
+                        uploadRect_.z - uploadRect_.x + 1, uploadRect_.w - uploadRect_.y + 1,
+                        GL_BGRA, GL_UNSIGNED_INT_8_8_8_8_REV, reinterpret_cast<void *>(offset));
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+    }
 
-    // CPU -> second PBO
-    glBindBufferARB(GL_PIXEL_UNPACK_BUFFER_ARB, PBOs_[nextIndex]);
-    prepareScene();
-    renderScene(textureImages_[nextIndex]);
-    glBufferDataARB(GL_PIXEL_UNPACK_BUFFER_ARB, bufferSize_, textureImages_[nextIndex], GL_STREAM_DRAW_ARB);
+    uploadPending_ = false;
+}
+
+void MainWindow::updateResolution(float frameTime)
+{
+    if (!dynamicResolution_ || !governor_.update(frameTime))
+    {
+        return;
+    }
+
+    setRenderSize(governor_.getScale(), governor_.getSamples());
+}
+
+bool MainWindow::refineFrame()
+{
+    bool viewChanged = viewMatrix_ != lastViewMatrix_;
+    bool moved       = viewChanged || !progressive_;
+    bool stale       = redraw_ || sceneGraph_.isDirty();
+
+    // Partial redraws need everything but the moved nodes to stay the same
+    if (viewChanged || redraw_)
+    {
+        frameReusable_ = false;
+    }
+
+    viewMoving_     = viewChanged;
+    lastViewMatrix_ = viewMatrix_;
+    redraw_         = false;
+    framePass_      = -1;
+    jitter_         = glm::vec2(0.0f);
+
+    // Passes in flight no longer add up to the image
+    if (moved || (stale && (refineLevel_ != REFINE_MOVING)))
+    {
+        for (FrameContext* frame : inFlight_)
+        {
+            frame->pass = -1;
+        }
+    }
+
+    // Any refinement is out of date, go back to the governed setting
+    if (moved)
+    {
+        if (refineLevel_ != REFINE_MOVING)
+        {
+            refineLevel_  = REFINE_MOVING;
+            refineDirect_ = false;
+            setRenderSize(governor_.getScale(), governor_.getSamples());
+        }
+
+        return true;
+    }
+
+    // Nodes changing under a still camera: the summed passes do not hold
+    // any more, draw with all samples at once as long as they change
+    if (stale && (refineLevel_ != REFINE_MOVING))
+    {
+        if (!refineDirect_)
+        {
+            refineLevel_  = REFINE_SAMPLES;
+            refineDirect_ = true;
+            setRenderSize(1.0f, samples_);
+        }
+
+        return true;
+    }
+
+    // Keep the finished image until something changes
+    if ((refineLevel_ != REFINE_MOVING) && (refineDirect_ || (refinePass_ >= samples_ * samples_)))
+    {
+        refineLevel_ = REFINE_SAMPLES;
+
+        return false;
+    }
+
+    if (refineLevel_ == REFINE_MOVING)
+    {
+        // First pass: the full resolution frame, exact even if the last moving one was interlaced
+        refineLevel_ = REFINE_RESOLUTION;
+        refinePass_  = 0;
+        setRenderSize(1.0f, 1);
+    }
+    else
+    {
+        // Every pass redraws the whole frame
+        refineLevel_   = REFINE_SAMPLES;
+        frameReusable_ = false;
+    }
+
+    // Pass k moves the frame by the offset of sample k in the multisampling
+    // grid, k / samples of a pixel along x and y
+    jitter_    = glm::vec2(refinePass_ % samples_, refinePass_ / samples_) / static_cast<float>(samples_);
+    framePass_ = refinePass_++;
+
+    return true;
+}
+
+void MainWindow::accumulateFrame(FrameContext& frame)
+{
+    size_t count = static_cast<size_t>(frame.width) * frame.height * 4;
+
+    if (frame.pass == 0)
+    {
+        accumulation_.assign(frame.image, frame.image + count);
+        return;
+    }
+
+    // The render size changed since the sum began, start over at pass 0
+    if (accumulation_.size() != count)
+    {
+        for (FrameContext* other : inFlight_)
+        {
+            other->pass = -1;
+        }
+
+        refinePass_ = 0;
+        return;
+    }
+
+    float scale = 1.0f / (frame.pass + 1);
+
+    for (size_t i = 0; i < count; i++)
+    {
+        accumulation_[i] += frame.image[i];
+        frame.image[i]    = static_cast<GLubyte>(accumulation_[i] * scale + 0.5f);
+    }
+}
+
+void MainWindow::setRenderSize(float scale, int samples)
+{
+    frameReusable_ = false;
+
+    int width  = std::max(1, static_cast<int>(windowWidth_ * scale));
+    int height = std::max(1, static_cast<int>(windowHeight_ * scale));
+
+    // The screen quad is linearly filtered, which upscales the result to the window
+    if (multisample_)
+    {
+        renderWidth_   = width;
+        renderHeight_  = height;
+        rasterSamples_ = samples;
+    }
+    else
+    {
+        renderWidth_   = width * samples;
+        renderHeight_  = height * samples;
+        rasterSamples_ = 1;
+    }
+
+    // Frame contexts pick the size up when they are bound
+    rasterWidth_  = renderWidth_;
+    rasterHeight_ = renderHeight_;
 }
 
 void MainWindow::drawToScreen()
@@ -235,99 +645,269 @@ void MainWindow::renderQuad()
     glBindVertexArray(0);
 }
 
+void MainWindow::switchBackend()
+{
+    // Frames in flight keep their backend, the next one binds the other
+    useTileRasterizer_ = !useTileRasterizer_;
+    frameReusable_     = false;
+}
+
 void MainWindow::prepareScene()
 {
-    scanLine_->reset();
+    rasterizer_->reset();
 
-    scanLine_->setViewDir(camera_.getFront());
+    rasterizer_->setViewDir(camera_.getFront());
+    rasterizer_->setViewProjection(projectionMatrix_ * viewMatrix_);
+    rasterizer_->setLights(lights_, camera_.getPosition());
     glm::mat4x4 VPMatrix = projectionMatrix_ * viewMatrix_;
 
-    for (DrawableObject* object : drawableObjects_)
+    // Refinement passes sample the scene a part of a pixel further along x
+    // and y, so the image moves the other way. The camera itself stays, so
+    // interlacing does not take them for motion
+    if (jitter_ != glm::vec2(0.0f))
     {
-        // Set mvp matrix for this model
-        scanLine_->setMVP(VPMatrix * object->modelMatrix);
+        glm::vec3 offset = -glm::vec3(jitter_.x / std::max(renderWidth_ - 1, 1), jitter_.y / std::max(renderHeight_ - 1, 1), 0.0f);
 
-        // Insert polygon into scanline pipeline
-        for (auto geometry : object->geometries)
+        VPMatrix = glm::translate(glm::mat4(1.0f), offset) * VPMatrix;
+    }
+
+    // Only moved subtrees are recomputed, MVPs only when the camera moved
+    sceneGraph_.update(VPMatrix);
+
+    // Redraw only where nodes moved when the rest of the last frame still holds
+    partialFrame_ = partialRedraw_ && frameReusable_ && (rasterizer_ == scanLine_);
+
+    if (partialFrame_)
+    {
+        dirtyRect_ = screenRect(sceneGraph_.getDirtyBounds());
+        scanLine_->setDirtyRegion(dirtyRect_.x, dirtyRect_.y, dirtyRect_.z, dirtyRect_.w);
+    }
+    else
+    {
+        scanLine_->clearDirtyRegion();
+    }
+
+    // Bands need workers to draw on, and interlaced frames the history of
+    // the single context. With interlacing, the first moving frame after
+    // banded ones is drawn whole to start that history again
+    bandedFrame_ = (rasterizer_ == scanLine_) && (TaskScheduler::shared().getSlotCount() > 1) &&
+                   !(scanLine_->getInterlacing() && viewMoving_);
+
+    sceneDraws_.clear();
+
+    for (SceneNode* node : sceneGraph_.collectVisible())
+    {
+        DrawableObject* object = node->getDrawable();
+
+        // Nodes away from the redrawn area cannot change it
+        if (partialFrame_)
         {
-            for (auto face : geometry->faces)
+            glm::ivec4 rect = screenRect(sceneGraph_.projectBounds(node));
+
+            if ((rect.z < dirtyRect_.x) || (rect.x > dirtyRect_.z) || (rect.w < dirtyRect_.y) || (rect.y > dirtyRect_.w))
             {
-                scanLine_->insertPolygon(face, geometry, object->useTexture);
+                continue;
             }
         }
+
+        glm::mat4 modelView = viewMatrix_ * node->getWorldTransform();
+
+        for (int i = 0; i < object->geometries.size(); i++)
+        {
+            sceneDraws_.push_back({ node->getMVP(), node->getWorldTransform(), selectLod(node, i, modelView),
+                                    object->useTexture });
+        }
+    }
+
+    // Bands insert the scene themselves when they draw
+    if (!bandedFrame_)
+    {
+        submitScene(*rasterizer_, sceneDraws_);
     }
 }
 
-void MainWindow::renderScene(GLubyte* buffer)
+void MainWindow::submitScene(Rasterizer& target, const vector<SceneDraw>& draws)
 {
-    scanLine_->draw(buffer);
+    for (const SceneDraw& draw : draws)
+    {
+        // Set mvp matrix for this model
+        target.setMVP(draw.mvp);
+        target.setModel(draw.model);
+
+        // Insert polygon into scanline pipeline
+        target.insertPolygons(draw.geometry, draw.useTexture);
+    }
 }
 
-void MainWindow::loadResources()
+glm::ivec4 MainWindow::screenRect(const glm::vec4& bounds)
 {
-    glm::mat4 model(1.0);
-    DrawableObject* resource;
+    int   samples = rasterizer_->getSamples();
+    float scaleX  = static_cast<float>(renderWidth_ * samples - 1) / samples;
+    float scaleY  = static_cast<float>(renderHeight_ * samples - 1) / samples;
+
+    // Same mapping as the rasterizers, clamped before it can overflow
+    auto toPixel = [](float ndc, float scale) {
+                       return (std::min(std::max(ndc, -1.0f), 1.0f) + 0.5f) * scale;
+                   };
+
+    // One pixel of margin for the rounding of the edges
+    int left   = static_cast<int>(floor(toPixel(bounds.x, scaleX))) - 1;
+    int bottom = static_cast<int>(floor(toPixel(bounds.y, scaleY))) - 1;
+    int right  = static_cast<int>(ceil(toPixel(bounds.z, scaleX))) + 1;
+    int top    = static_cast<int>(ceil(toPixel(bounds.w, scaleY))) + 1;
+
+    return glm::ivec4(std::max(left, 0), std::max(bottom, 0),
+                      std::min(right, renderWidth_ - 1), std::min(top, renderHeight_ - 1));
+}
 
-    // Load models
-    switch (showModel_)
+GeometryResource * MainWindow::selectLod(SceneNode* node, int index, const glm::mat4& modelView)
+{
+    GeometryResource* geometry = node->getDrawable()->geometries[index];
+    int             & level    = node->getLodLevel(index);
+
+    if (geometry->lods.empty())
     {
-    case (0):
-        drawableObjects_.push_back(resourceManager_.loadCube());
-        break;
+        return geometry;
+    }
 
-    case (1):
-        model    = glm::translate(model, glm::vec3(0.0, -1.0, 0.0));
-        model    = glm::scale(model, glm::vec3(0.01, 0.01, 0.01));
-        resource = resourceManager_.loadModel("resources/models/p21/p21.obj", model);
+    // Project the bounding sphere onto the screen
+    glm::vec3 center = glm::vec3(modelView * glm::vec4(geometry->boundCenter, 1.0f));
+    float     scale  = std::max(glm::length(glm::vec3(modelView[0])),
+                                std::max(glm::length(glm::vec3(modelView[1])), glm::length(glm::vec3(modelView[2]))));
+    float radius   = geometry->boundRadius * scale;
+    float distance = -center.z;
 
-        if (resource == nullptr)
-        {
-            return;
-        }
+    if (distance <= radius + nearPlane_)
+    {
+        // Camera is inside or close to the object
+        level = 0;
 
-        drawableObjects_.push_back(resource);
-        break;
+        return geometry;
+    }
 
-    case (2):
-        model    = glm::translate(model, glm::vec3(0.0, -0.2, 0.0));
-        model    = glm::scale(model, glm::vec3(0.001f, 0.001f, 0.001f));
-        resource = resourceManager_.loadModel("resources/models/house_obj/house_obj.obj", model);
+    // In pixels. The rasterizers map -0.5..0.5 of normalized device
+    // coordinates onto the rows, so a unit is the whole height and not
+    // half of it
+    int   samples      = rasterizer_->getSamples();
+    float screenRadius = radius * projectionMatrix_[1][1] / distance * (renderHeight_ * samples - 1) / samples;
 
-        if (resource == nullptr)
-        {
-            return;
-        }
+    // Each level quarters the faces, which matches a halved screen radius
+    float wanted   = log2(lodRadius_ / std::max(screenRadius, 1.0f));
+    int   maxLevel = static_cast<int>(geometry->lods.size());
 
-        drawableObjects_.push_back(resource);
-        break;
+    // Only switch when clearly past the current level to avoid popping
+    if ((wanted > level + 1 + lodHysteresis_) || (wanted < level - lodHysteresis_))
+    {
+        level = std::min(std::max(static_cast<int>(floor(wanted)), 0), maxLevel);
+    }
 
-    case (3):
-        model    = glm::translate(model, glm::vec3(0, -1, 0));
-        resource = resourceManager_.loadModel("resources/models/T-90/T-90.obj", model);
+    return geometry->getLod(level);
+}
 
-        if (resource == nullptr)
-        {
-            return;
-        }
+void MainWindow::renderScene(FrameContext& frame)
+{
+    if (!frame.banded)
+    {
+        frame.rasterizer->draw(frame.image);
+        frame.polygons     = frame.rasterizer->getNumPolygon();
+        frame.lightingTime = frame.rasterizer->getLightingTime();
 
-        drawableObjects_.push_back(resource);
-        break;
+        return;
+    }
 
-    case (4):
-        model    = glm::scale(model, glm::vec3(0.1, 0.1, 0.1));
-        model    = glm::translate(model, glm::vec3(0, -7, 0));
-        resource = resourceManager_.loadModel("resources/models/nanosuit_reflection/nanosuit.obj", model);
+    TaskScheduler& scheduler = TaskScheduler::shared();
+    int            bands     = BANDS_PER_SLOT * scheduler.getSlotCount();
+    int            width     = frame.scanLine->getWidth();
+    int            height    = frame.scanLine->getHeight();
+    vector<int>    polygons(bands, 0);
+    vector<float>  lightingTimes(bands, 0.0f);
+
+    // Bands write disjoint rows of the frame, each slot with its own context.
+    // Frames in flight share them, a slot draws one band at a time
+    auto drawBands = [&](int first, int last) {
+                         ZBufferScanLine*& band = bandContexts_[scheduler.getSlot()];
+
+                         for (int i = first; i < last; i++)
+                         {
+                             int left   = 0;
+                             int right  = width - 1;
+                             int bottom = i * height / bands;
+                             int top    = (i + 1) * height / bands - 1;
+
+                             // A partial frame only redraws the dirty rectangle
+                             if (frame.partial)
+                             {
+                                 left   = frame.rect.x;
+                                 right  = frame.rect.z;
+                                 bottom = std::max(bottom, frame.rect.y);
+                                 top    = std::min(top, frame.rect.w);
+                             }
+
+                             if ((left > right) || (bottom > top))
+                             {
+                                 continue;
+                             }
+
+                             if (band == nullptr)
+                             {
+                                 band = new ZBufferScanLine(width, height, nearPlane_, farPlane_, frame.scanLine->getSamples());
+                             }
+
+                             drawBand(frame, *band, left, bottom, right, top);
+                             polygons[i]      = band->getNumPolygon();
+                             lightingTimes[i] = band->getLightingTime();
+                         }
+                     };
+
+    scheduler.parallelFor(0, bands, 1, drawBands);
+
+    // The history of the frame's context is older than this frame now
+    frame.scanLine->invalidateHistory();
+
+    // Polygons crossing bands count once per band
+    frame.polygons     = 0;
+    frame.lightingTime = 0.0f;
+
+    for (int i = 0; i < bands; i++)
+    {
+        frame.polygons     += polygons[i];
+        frame.lightingTime += lightingTimes[i];
+    }
+}
 
-        if (resource == nullptr)
-        {
-            return;
-        }
+void MainWindow::drawBand(FrameContext& frame, ZBufferScanLine& band, int left, int bottom, int right, int top)
+{
+    ZBufferScanLine* scanLine = frame.scanLine;
 
-        drawableObjects_.push_back(resource);
-        break;
+    if ((band.getWidth() != scanLine->getWidth()) || (band.getHeight() != scanLine->getHeight()) ||
+        (band.getSamples() != scanLine->getSamples()))
+    {
+        band.resize(scanLine->getWidth(), scanLine->getHeight(), scanLine->getSamples());
+    }
 
-    default:
-        break;
+    // Same settings as the frame's context, but never interlaced
+    band.setVisibilityBuffer(scanLine->getVisibilityBuffer());
+    band.setBilinearFilter(scanLine->getBilinearFilter());
+    band.setLighting(scanLine->getLighting());
+
+    band.reset();
+    band.setViewDir(frame.viewDir);
+    band.setViewProjection(frame.viewProjection);
+    band.setLights(lights_, frame.eye);
+
+    // Polygons off the band are dropped at insertion, edges above it are only stepped
+    band.setDirtyRegion(left, bottom, right, top);
+    submitScene(band, frame.draws);
+    band.draw(frame.image);
+}
+
+void MainWindow::loadResources()
+{
+    SceneNode* resource = resourceManager_.loadPreset(showModel_, true);
+
+    if (resource != nullptr)
+    {
+        sceneGraph_.getRoot()->addChild(resource);
     }
 }
 
@@ -370,6 +950,7 @@ void MainWindow::keyboardEvent(GLFWwindow* window, int key, int scancode, int ac
     if (action == GLFW_PRESS)
     {
         keys_[key] = true;
+        redraw_    = true;
     }
     else if (action == GLFW_RELEASE)
     {
@@ -380,6 +961,48 @@ void MainWindow::keyboardEvent(GLFWwindow* window, int key, int scancode, int ac
     {
         isRendering_ = !isRendering_;
     }
+
+    if ((key == GLFW_KEY_B) && (action == GLFW_PRESS))
+    {
+        instance_->switchBackend();
+    }
+
+    if ((key == GLFW_KEY_L) && (action == GLFW_PRESS))
+    {
+        instance_->lighting_ = !instance_->lighting_;
+    }
+
+    if ((key == GLFW_KEY_V) && (action == GLFW_PRESS))
+    {
+        instance_->visibilityBuffer_ = !instance_->visibilityBuffer_;
+    }
+
+    if ((key == GLFW_KEY_I) && (action == GLFW_PRESS))
+    {
+        instance_->interlace_ = !instance_->interlace_;
+    }
+
+    if ((key == GLFW_KEY_F) && (action == GLFW_PRESS))
+    {
+        instance_->bilinearFilter_ = !instance_->bilinearFilter_;
+    }
+
+    if ((key == GLFW_KEY_M) && (action == GLFW_PRESS))
+    {
+        instance_->animate_ = !instance_->animate_;
+    }
+
+    if ((key == GLFW_KEY_P) && (action == GLFW_PRESS))
+    {
+        // Moving frames only get supersampled without refinement
+        instance_->progressive_ = !instance_->progressive_;
+        instance_->governor_    = ResolutionGovernor(instance_->frameBudget_, instance_->minScale_,
+                                                     instance_->progressive_ ? 1 : instance_->samples_);
+
+        // Start over from the governed setting
+        instance_->refineLevel_    = REFINE_SAMPLES;
+        instance_->lastViewMatrix_ = glm::mat4(0.0f);
+    }
 }
 
 void MainWindow::cursorMoveEvent(GLFWwindow* window, double xpos, double ypos)
@@ -0,0 +1,441 @@
+#include "MeshSimplifier.h"
+
+#include <algorithm>
+#include <map>
+#include <utility>
+using namespace std;
+
+#include "Geometry.h"
+#include "ResourceManager.h"
+
+static const double BOUNDARY_WEIGHT = 1000.0; // Penalty for moving open borders
+static const double FLIP_LIMIT      = 0.2;    // Minimum cosine between old and new face normal
+
+void MeshSimplifier::Quadric::addPlane(const glm::dvec4& plane, double weight)
+{
+    const double a = plane.x, b = plane.y, c = plane.z, d = plane.w;
+
+    m[0] += weight * a * a; m[1] += weight * a * b; m[2] += weight * a * c; m[3] += weight * a * d;
+    m[4] += weight * b * b; m[5] += weight * b * c; m[6] += weight * b * d;
+    m[7] += weight * c * c; m[8] += weight * c * d;
+    m[9] += weight * d * d;
+}
+
+void MeshSimplifier::Quadric::add(const Quadric& other)
+{
+    for (int i = 0; i < 10; i++)
+    {
+        m[i] += other.m[i];
+    }
+}
+
+double MeshSimplifier::Quadric::error(const glm::dvec3& p) const
+{
+    const double x = p.x, y = p.y, z = p.z;
+
+    return m[0] * x * x + 2 * m[1] * x * y + 2 * m[2] * x * z + 2 * m[3] * x
+           + m[4] * y * y + 2 * m[5] * y * z + 2 * m[6] * y
+           + m[7] * z * z + 2 * m[8] * z
+           + m[9];
+}
+
+MeshSimplifier::MeshSimplifier(GeometryResource* source) :
+    source_(source)
+{}
+
+GeometryResource * MeshSimplifier::simplify(int targetFaces)
+{
+    if (!prepare())
+    {
+        return nullptr;
+    }
+
+    while (numTriangles_ > targetFaces && !heap_.empty())
+    {
+        pop_heap(heap_.begin(), heap_.end());
+        Collapse next = heap_.back();
+        heap_.pop_back();
+
+        // Skip outdated collapses
+        if (removed_[next.from] || removed_[next.to]
+            || (stamps_[next.from] != next.fromStamp) || (stamps_[next.to] != next.toStamp))
+        {
+            continue;
+        }
+
+        if (isValid(next.from, next.to))
+        {
+            collapse(next.from, next.to);
+        }
+    }
+
+    return build();
+}
+
+bool MeshSimplifier::prepare()
+{
+    auto& vertices = source_->vertices;
+    auto& faces    = source_->faces;
+
+    positions_.resize(vertices.size());
+    vertexTriangles_.assign(vertices.size(), vector<int>());
+    quadrics_.assign(vertices.size(), Quadric());
+    locked_.assign(vertices.size(), false);
+    removed_.assign(vertices.size(), false);
+    stamps_.assign(vertices.size(), 0);
+    welded_.resize(vertices.size());
+    copies_.assign(vertices.size(), vector<int>());
+    triangles_.clear();
+    corners_.clear();
+    heap_.clear();
+
+    for (size_t i = 0; i < vertices.size(); i++)
+    {
+        positions_[i] = glm::dvec3(vertices[i]->position);
+    }
+
+    // Vertices split by anything but their uv are welded, so the collapses
+    // see one surface. A position with several uvs lies on a uv seam
+    typedef pair<float, pair<float, float> > PositionKey;
+    map<PositionKey, int>                           positionOwner;
+    map<pair<PositionKey, pair<float, float> >, int> wedgeOwner;
+
+    for (size_t i = 0; i < vertices.size(); i++)
+    {
+        const glm::vec3& p   = vertices[i]->position;
+        const glm::vec2& uv  = vertices[i]->texCoord;
+        PositionKey position = make_pair(p.x, make_pair(p.y, p.z));
+        auto wedge           = wedgeOwner.insert(make_pair(make_pair(position, make_pair(uv.x, uv.y)), static_cast<int>(i)));
+
+        welded_[i] = wedge.first->second;
+        copies_[welded_[i]].push_back(static_cast<int>(i));
+
+        if (!wedge.second)
+        {
+            continue;
+        }
+
+        auto owner = positionOwner.insert(make_pair(position, static_cast<int>(i)));
+
+        if (!owner.second)
+        {
+            locked_[i]                   = true;
+            locked_[owner.first->second] = true;
+        }
+    }
+
+    for (auto face : faces)
+    {
+        // Only triangulated geometries are supported
+        if (face->indices.size() != 3)
+        {
+            return false;
+        }
+
+        glm::ivec3 corners(face->indices[0], face->indices[1], face->indices[2]);
+        glm::ivec3 tri(welded_[corners[0]], welded_[corners[1]], welded_[corners[2]]);
+
+        // No area once welded
+        if ((tri[0] == tri[1]) || (tri[1] == tri[2]) || (tri[2] == tri[0]))
+        {
+            continue;
+        }
+
+        triangles_.push_back(tri);
+        corners_.push_back(corners);
+    }
+
+    numTriangles_ = static_cast<int>(triangles_.size());
+    triangleRemoved_.assign(triangles_.size(), false);
+
+    // Face quadrics and adjacency
+    map<pair<int, int>, int> edgeFaces;
+
+    for (int t = 0; t < numTriangles_; t++)
+    {
+        const glm::ivec3& tri = triangles_[t];
+        glm::dvec3 normal     = glm::cross(positions_[tri[1]] - positions_[tri[0]], positions_[tri[2]] - positions_[tri[0]]);
+        double     area       = glm::length(normal);
+
+        if (area > 0)
+        {
+            normal = normal / area;
+        }
+
+        glm::dvec4 plane(normal, -glm::dot(normal, positions_[tri[0]]));
+
+        for (int k = 0; k < 3; k++)
+        {
+            quadrics_[tri[k]].addPlane(plane, area);
+            vertexTriangles_[tri[k]].push_back(t);
+
+            int a = tri[k];
+            int b = tri[(k + 1) % 3];
+            edgeFaces[make_pair(min(a, b), max(a, b))]++;
+        }
+    }
+
+    // Open borders get a perpendicular penalty plane so they keep their shape
+    for (int t = 0; t < numTriangles_; t++)
+    {
+        const glm::ivec3& tri = triangles_[t];
+        glm::dvec3 normal     = glm::cross(positions_[tri[1]] - positions_[tri[0]], positions_[tri[2]] - positions_[tri[0]]);
+
+        for (int k = 0; k < 3; k++)
+        {
+            int a = tri[k];
+            int b = tri[(k + 1) % 3];
+
+            if (edgeFaces[make_pair(min(a, b), max(a, b))] != 1)
+            {
+                continue;
+            }
+
+            glm::dvec3 edge   = positions_[b] - positions_[a];
+            glm::dvec3 border = glm::cross(edge, normal);
+            double     length = glm::length(border);
+
+            if (length <= 0)
+            {
+                continue;
+            }
+
+            border = border / length;
+            glm::dvec4 plane(border, -glm::dot(border, positions_[a]));
+            quadrics_[a].addPlane(plane, BOUNDARY_WEIGHT);
+            quadrics_[b].addPlane(plane, BOUNDARY_WEIGHT);
+        }
+    }
+
+    for (auto& edge : edgeFaces)
+    {
+        pushEdge(edge.first.first, edge.first.second);
+    }
+
+    return true;
+}
+
+void MeshSimplifier::pushEdge(int a, int b)
+{
+    Quadric sum = quadrics_[a];
+    sum.add(quadrics_[b]);
+
+    // Choose the cheaper direction that does not move a locked vertex
+    Collapse best;
+    bool     found = false;
+
+    if (!locked_[a])
+    {
+        best  = { sum.error(positions_[b]), a, b, stamps_[a], stamps_[b] };
+        found = true;
+    }
+
+    if (!locked_[b])
+    {
+        double cost = sum.error(positions_[a]);
+
+        if (!found || (cost < best.cost))
+        {
+            best  = { cost, b, a, stamps_[b], stamps_[a] };
+            found = true;
+        }
+    }
+
+    if (!found)
+    {
+        return;
+    }
+
+    heap_.push_back(best);
+    push_heap(heap_.begin(), heap_.end());
+}
+
+bool MeshSimplifier::isValid(int from, int to)
+{
+    // Link condition: the two vertices may share only two neighbours
+    vector<int> fromRing;
+    vector<int> toRing;
+
+    for (int t : vertexTriangles_[from])
+    {
+        for (int k = 0; k < 3; k++)
+        {
+            fromRing.push_back(triangles_[t][k]);
+        }
+    }
+
+    for (int t : vertexTriangles_[to])
+    {
+        for (int k = 0; k < 3; k++)
+        {
+            toRing.push_back(triangles_[t][k]);
+        }
+    }
+
+    sort(fromRing.begin(), fromRing.end());
+    fromRing.erase(unique(fromRing.begin(), fromRing.end()), fromRing.end());
+    sort(toRing.begin(), toRing.end());
+    toRing.erase(unique(toRing.begin(), toRing.end()), toRing.end());
+
+    vector<int> shared;
+    set_intersection(fromRing.begin(), fromRing.end(), toRing.begin(), toRing.end(), back_inserter(shared));
+
+    // Shared ring includes the two vertices themselves
+    if (shared.size() > 4)
+    {
+        return false;
+    }
+
+    // Reject collapses that flip or degenerate a remaining triangle
+    for (int t : vertexTriangles_[from])
+    {
+        const glm::ivec3& tri = triangles_[t];
+
+        if ((tri[0] == to) || (tri[1] == to) || (tri[2] == to))
+        {
+            continue;
+        }
+
+        glm::dvec3 p[3];
+        glm::dvec3 q[3];
+
+        for (int k = 0; k < 3; k++)
+        {
+            p[k] = positions_[tri[k]];
+            q[k] = tri[k] == from ? positions_[to] : p[k];
+        }
+
+        glm::dvec3 before = glm::cross(p[1] - p[0], p[2] - p[0]);
+        glm::dvec3 after  = glm::cross(q[1] - q[0], q[2] - q[0]);
+        double     lenB   = glm::length(before);
+        double     lenA   = glm::length(after);
+
+        if ((lenA <= 0) || (lenB <= 0) || (glm::dot(before, after) < FLIP_LIMIT * lenA * lenB))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void MeshSimplifier::collapse(int from, int to)
+{
+    auto& toTriangles = vertexTriangles_[to];
+
+    for (int t : vertexTriangles_[from])
+    {
+        glm::ivec3& tri = triangles_[t];
+
+        if ((tri[0] == to) || (tri[1] == to) || (tri[2] == to))
+        {
+            // Triangle degenerates
+            triangleRemoved_[t] = true;
+            numTriangles_--;
+
+            for (int k = 0; k < 3; k++)
+            {
+                if (tri[k] != from)
+                {
+                    auto& list = vertexTriangles_[tri[k]];
+                    list.erase(std::remove(list.begin(), list.end(), t), list.end());
+                }
+            }
+        }
+        else
+        {
+            for (int k = 0; k < 3; k++)
+            {
+                if (tri[k] == from)
+                {
+                    tri[k]         = to;
+                    corners_[t][k] = closestCopy(to, corners_[t][k]);
+                }
+            }
+
+            toTriangles.push_back(t);
+        }
+    }
+
+    vertexTriangles_[from].clear();
+    removed_[from] = true;
+    quadrics_[to].add(quadrics_[from]);
+    stamps_[to]++;
+
+    // Re-evaluate all edges around the surviving vertex
+    vector<int> ring;
+
+    for (int t : toTriangles)
+    {
+        for (int k = 0; k < 3; k++)
+        {
+            if (triangles_[t][k] != to)
+            {
+                ring.push_back(triangles_[t][k]);
+            }
+        }
+    }
+
+    sort(ring.begin(), ring.end());
+    ring.erase(unique(ring.begin(), ring.end()), ring.end());
+
+    for (int neighbour : ring)
+    {
+        pushEdge(neighbour, to);
+    }
+}
+
+int MeshSimplifier::closestCopy(int welded, int corner)
+{
+    auto& vertices = source_->vertices;
+    int   best     = welded;
+    float bestDot  = -2.0f;
+
+    for (int copy : copies_[welded])
+    {
+        float cosine = glm::dot(vertices[copy]->normal, vertices[corner]->normal);
+
+        if (cosine > bestDot)
+        {
+            best    = copy;
+            bestDot = cosine;
+        }
+    }
+
+    return best;
+}
+
+GeometryResource * MeshSimplifier::build()
+{
+    GeometryResource* result = new GeometryResource;
+    vector<int> remap(positions_.size(), -1);
+
+    for (size_t t = 0; t < triangles_.size(); t++)
+    {
+        if (triangleRemoved_[t])
+        {
+            continue;
+        }
+
+        Geometry::Face* face = new Geometry::Face(result->vertices);
+
+        for (int k = 0; k < 3; k++)
+        {
+            int index = corners_[t][k];
+
+            if (remap[index] < 0)
+            {
+                remap[index] = static_cast<int>(result->vertices.size());
+                result->vertices.push_back(new Geometry::Vertice(*source_->vertices[index]));
+            }
+
+            face->indices.push_back(remap[index]);
+        }
+
+        result->faces.push_back(face);
+    }
+
+    result->textures = source_->textures;
+
+    return result;
+}
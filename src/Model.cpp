@@ -8,12 +8,13 @@ using namespace std;
 
 #include "Geometry.h"
 #include "ResourceManager.h"
+#include "SceneGraph.h"
 
 void Model::loadModel(string path)
 {
     Assimp::Importer import;
+    // No aiProcess_OptimizeGraph, the node hierarchy is kept as a scene graph
     auto readOptions = aiProcess_OptimizeMeshes |
-                       aiProcess_OptimizeGraph |
                        aiProcess_Triangulate |
                        aiProcess_SplitLargeMeshes |
                        aiProcess_ImproveCacheLocality |
@@ -24,40 +25,59 @@ void Model::loadModel(string path)
     if (!scene || (scene->mFlags == AI_SCENE_FLAGS_INCOMPLETE) || !scene->mRootNode)
     {
         cout << "ERROR::ASSIMP::" << import.GetErrorString() << endl;
-        drawable_ = nullptr;
+        root_ = nullptr;
 
         return;
     }
 
     this->directory_ = path.substr(0, path.find_last_of('/'));
 
-    this->processNode(scene->mRootNode, scene);
+    root_ = this->processNode(scene->mRootNode, scene);
 
-    drawable_ = new DrawableObject(geometryRcs_);
-
-    if (totalTextureLoaded_ > 0)
+    for (DrawableObject* drawable : drawables_)
     {
-        drawable_->useTexture = true;
+        drawable->useTexture = totalTextureLoaded_ > 0;
     }
 }
 
-void Model::processNode(aiNode* node, const aiScene* scene)
+SceneNode * Model::processNode(aiNode* node, const aiScene* scene)
 {
+    // Assimp matrices are row major
+    const aiMatrix4x4& m = node->mTransformation;
+    glm::mat4 local = glm::mat4(m.a1, m.b1, m.c1, m.d1,
+                                m.a2, m.b2, m.c2, m.d2,
+                                m.a3, m.b3, m.c3, m.d3,
+                                m.a4, m.b4, m.c4, m.d4);
+
     // Process all the node's meshes (if any)
+    std::vector<GeometryResource *> geometries;
+
     for (unsigned int i = 0; i < node->mNumMeshes; i++)
     {
         aiMesh* mesh = scene->mMeshes[node->mMeshes[i]];
-        this->processMesh(mesh, scene);
+        geometries.push_back(this->processMesh(mesh, scene));
+    }
+
+    DrawableObject* drawable = nullptr;
+
+    if (!geometries.empty())
+    {
+        drawable = new DrawableObject(geometries);
+        drawables_.push_back(drawable);
     }
 
+    SceneNode* sceneNode = new SceneNode(drawable, local);
+
     // Then do the same for each of its children
     for (unsigned int i = 0; i < node->mNumChildren; i++)
     {
-        this->processNode(node->mChildren[i], scene);
+        sceneNode->addChild(this->processNode(node->mChildren[i], scene));
     }
+
+    return sceneNode;
 }
 
-void Model::processMesh(aiMesh* mesh, const aiScene* scene)
+GeometryResource * Model::processMesh(aiMesh* mesh, const aiScene* scene)
 {
     auto geometryRc = new GeometryResource;
     int  triCnt     = 0;
@@ -69,13 +89,10 @@ void Model::processMesh(aiMesh* mesh, const aiScene* scene)
         vertice->position = glm::vec3(mesh->mVertices[i].x, mesh->mVertices[i].y, mesh->mVertices[i].z);
 
         // TODO: Implement normal map support
-        // if (mesh->HasNormals())
-        // {
-        // vector.x = mesh->mNormals[i].x;
-        // vector.y = mesh->mNormals[i].y;
-        // vector.z = mesh->mNormals[i].z;
-        // vertex.Normal = vector;
-        // }
+        if (mesh->HasNormals())
+        {
+            vertice->normal = glm::vec3(mesh->mNormals[i].x, mesh->mNormals[i].y, mesh->mNormals[i].z);
+        }
 
         if (mesh->HasVertexColors(0))
         {
@@ -130,7 +147,10 @@ void Model::processMesh(aiMesh* mesh, const aiScene* scene)
         // aiTextureType_AMBIENT, "texture_ambient", geometryRc);
     }
 
-    geometryRcs_.push_back(geometryRc);
+    geometryRc->computeBounds();
+    geometryRc->computeFacePlanes();
+
+    return geometryRc;
 }
 
 void Model::loadMaterialTextures(aiMaterial* mat, aiTextureType type, string typeName, GeometryResource* geometryRc)
@@ -143,6 +163,12 @@ void Model::loadMaterialTextures(aiMaterial* mat, aiTextureType type, string typ
         string filename = string(str.C_Str());
         filename = directory_ + '/' + filename;
 
+        if (deferTextures_)
+        {
+            textureRequests_.push_back({ geometryRc, filename, typeName });
+            continue;
+        }
+
         auto loadedTexture = parentManager_->getTextureResource(filename);
 
         if (loadedTexture == nullptr)
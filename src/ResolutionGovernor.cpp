@@ -0,0 +1,67 @@
+#include "ResolutionGovernor.h"
+
+#include <algorithm>
+#include <cmath>
+using namespace std;
+
+static const float SMOOTHING   = 0.3f;  // Weight of the newest frame time
+static const float TOLERANCE   = 0.1f;  // Dead band around the budget
+static const float MIN_STEP    = 0.8f;  // Fastest decrease of resolution per update
+static const float MAX_STEP    = 1.05f; // Fastest increase of resolution per update
+static const float SCALE_STEPS = 16.0f; // Scale is snapped to multiples of 1 / SCALE_STEPS
+
+ResolutionGovernor::ResolutionGovernor(float budget, float minScale, int maxSamples) :
+    budget_(budget), minScale_(minScale), maxSamples_(maxSamples),
+    samples_(maxSamples)
+{}
+
+bool ResolutionGovernor::update(float frameTime)
+{
+    smoothed_ = smoothed_ <= 0 ? frameTime : smoothed_ * (1 - SMOOTHING) + frameTime * SMOOTHING;
+
+    float ratio = budget_ / max(smoothed_, 0.01f);
+
+    if ((ratio > 1 - TOLERANCE) && (ratio < 1 + TOLERANCE))
+    {
+        return false;
+    }
+
+    // Density that would just meet the budget, raster cost grows with its square
+    float current = scale_ * samples_;
+    float target  = min(max(current * sqrt(ratio), minScale_), static_cast<float>(maxSamples_));
+
+    // Prefer dropping samples before dropping resolution
+    int   samples = max(1, min(maxSamples_, static_cast<int>(floor(target))));
+    float scale   = min(1.0f, target / samples);
+
+    // Resolution moves gradually while the sample count stays the same
+    if (samples == samples_)
+    {
+        scale = min(max(scale, scale_ * MIN_STEP), scale_ * MAX_STEP);
+    }
+
+    // Snap away from the current scale so small steps are not lost
+    scale = scale > scale_ ? ceil(scale * SCALE_STEPS) : floor(scale * SCALE_STEPS);
+    scale = min(1.0f, max(minScale_, scale / SCALE_STEPS));
+
+    if ((samples == samples_) && (scale == scale_))
+    {
+        return false;
+    }
+
+    // Only go up when the predicted time still fits, otherwise it would oscillate
+    float density = scale * samples;
+
+    if ((density > current) && (smoothed_ * (density / current) * (density / current) > budget_))
+    {
+        return false;
+    }
+
+    samples_ = samples;
+    scale_   = scale;
+
+    // Start measuring the new setting from scratch
+    smoothed_ = 0;
+
+    return true;
+}
@@ -2,18 +2,32 @@
 
 #include <SOIL\SOIL.h>
 
+#include <glm/gtc/matrix_transform.hpp>
+
 #include <iostream>
 #include <vector>
 using namespace std;
 
+#include "MeshSimplifier.h"
 #include "Model.h"
 #include "SimpleResources.h"
+#include "TaskScheduler.h"
+
+static const int   LOD_MAX_LEVELS = 4;     // Simplified levels per geometry
+static const float LOD_REDUCTION  = 0.25f; // Face ratio between two levels
+static const int   LOD_MIN_FACES  = 64;    // Stop simplifying below this
 
 ResourceManager::ResourceManager()
 {}
 
 ResourceManager::~ResourceManager()
 {
+    // Models still streaming are registered, to be released below, but no
+    // longer handed to their roots
+    TaskScheduler::shared().wait(streaming_);
+    streamingModels_.clear();
+    commitStreamed();
+
     for (auto& resource: loadedGeometries_)
     {
         delete resource.second;
@@ -28,6 +42,11 @@ ResourceManager::~ResourceManager()
     {
         delete object.second;
     }
+
+    for (auto& model: loadedModels_)
+    {
+        delete model.second;
+    }
 }
 
 DrawableObject * ResourceManager::loadCube(const glm::mat4& modelMatrix, string id)
@@ -57,6 +76,9 @@ DrawableObject * ResourceManager::loadCube(const glm::mat4& modelMatrix, string
             resource->faces.push_back(face);
         }
 
+        resource->computeBounds();
+        resource->computeFacePlanes();
+
         // Record object
         loadedResource = loadedGeometries_.insert_or_assign(string("Cube"), resource).first;
     }
@@ -124,6 +146,8 @@ DrawableObject * ResourceManager::loadTriangle(const glm::vec4& color, const glm
     Geometry::Face* face = new Geometry::Face(resource->vertices);
     face->indices = triIndice;
     resource->faces.push_back(face);
+    resource->computeBounds();
+    resource->computeFacePlanes();
 
     auto loadedResource = loadedGeometries_.insert_or_assign(string("Triangle"), resource).first;
 
@@ -162,6 +186,8 @@ DrawableObject * ResourceManager::loadQuad(const glm::vec4& color, const glm::ma
     Geometry::Face* face = new Geometry::Face(resource->vertices);
     face->indices = quadIndice;
     resource->faces.push_back(face);
+    resource->computeBounds();
+    resource->computeFacePlanes();
 
     auto loadedResource = loadedGeometries_.insert_or_assign(string("Quad"), resource).first;
 
@@ -171,42 +197,286 @@ DrawableObject * ResourceManager::loadQuad(const glm::vec4& color, const glm::ma
     return inserted.first->second;
 }
 
-DrawableObject * ResourceManager::loadModel(const string& path, const glm::mat4& modelMatrix, string id)
+SceneNode * ResourceManager::loadModel(const string& path, const glm::mat4& modelMatrix, string id)
 {
     if (id.empty())
     {
         id = path;
     }
 
-    auto loadedObject = loadedObjects_.find(id);
-    DrawableObject* loadedModel;
+    auto loadedModel = loadedModels_.find(id);
 
     // If resource does not exists
-    if (loadedObject == loadedObjects_.end())
+    if (loadedModel == loadedModels_.end())
     {
         Model model(this);
         model.loadModel(path);
 
-        loadedModel = model.getDrawableObject();
+        if (model.getSceneNode() == nullptr)
+        {
+            cout << "Unable to load resource: " << path << endl;
+
+            return nullptr;
+        }
+
+        // Geometries are simplified independently, one task each
+        TaskScheduler& scheduler = TaskScheduler::shared();
+        TaskGroup      lodTasks;
+
+        // Node drawables are released with the other objects
+        for (int i = 0; i < model.getDrawableObjects().size(); i++)
+        {
+            DrawableObject* drawable = model.getDrawableObjects()[i];
+
+            for (auto geometry: drawable->geometries)
+            {
+                scheduler.submit(lodTasks, [this, geometry]() {
+                                     generateLods(geometry);
+                                 });
+            }
+
+            loadedObjects_.insert_or_assign(id + "#" + to_string(i), drawable);
+        }
+
+        scheduler.wait(lodTasks);
+
+        loadedModel = loadedModels_.insert_or_assign(id, model.getSceneNode()).first;
     }
-    else
+
+    // Instances share the drawables of the loaded hierarchy
+    SceneNode* instance = new SceneNode(nullptr, modelMatrix);
+    instance->addChild(loadedModel->second->clone());
+
+    return instance;
+}
+
+SceneNode * ResourceManager::loadPreset(int preset, bool async)
+{
+    glm::mat4 model(1.0);
+    string    path;
+
+    switch (preset)
     {
-        // Just make a copy of it
-        loadedModel = new DrawableObject(*loadedObject->second);
+    case (0):
+        return new SceneNode(loadCube());
+
+    case (1):
+        model = glm::translate(model, glm::vec3(0.0, -1.0, 0.0));
+        model = glm::scale(model, glm::vec3(0.01, 0.01, 0.01));
+        path  = "resources/models/p21/p21.obj";
+        break;
+
+    case (2):
+        model = glm::translate(model, glm::vec3(0.0, -0.2, 0.0));
+        model = glm::scale(model, glm::vec3(0.001f, 0.001f, 0.001f));
+        path  = "resources/models/house_obj/house_obj.obj";
+        break;
+
+    case (3):
+        model = glm::translate(model, glm::vec3(0, -1, 0));
+        path  = "resources/models/T-90/T-90.obj";
+        break;
+
+    case (4):
+        model = glm::scale(model, glm::vec3(0.1, 0.1, 0.1));
+        model = glm::translate(model, glm::vec3(0, -7, 0));
+        path  = "resources/models/nanosuit_reflection/nanosuit.obj";
+        break;
+
+    default:
+        return nullptr;
     }
 
-    if (loadedModel == nullptr)
+    return async ? loadModelAsync(path, model) : loadModel(path, model);
+}
+
+SceneNode * ResourceManager::loadModelAsync(const string& path, const glm::mat4& modelMatrix, string id)
+{
+    if (id.empty())
     {
-        cout << "Unable to load resource: " << path << endl;
+        id = path;
+    }
 
-        return nullptr;
+    // Resident already
+    if (loadedModels_.find(id) != loadedModels_.end())
+    {
+        return loadModel(path, modelMatrix, id);
     }
 
-    // Generate drawable object with the loaded resource
-    loadedModel->modelMatrix = modelMatrix;
-    auto inserted = loadedObjects_.insert_or_assign(id, loadedModel);
+    SceneNode* instance  = new SceneNode(nullptr, modelMatrix);
+    auto       streaming = streamingModels_.find(id);
 
-    return inserted.first->second;
+    // Share the stream of an instance requested earlier
+    if (streaming != streamingModels_.end())
+    {
+        streaming->second.push_back(instance);
+
+        return instance;
+    }
+
+    streamingModels_[id].push_back(instance);
+
+    // Without workers nobody would pick the task up, load it right away
+    if (TaskScheduler::shared().getWorkerCount() == 0)
+    {
+        streamModel(path, id);
+
+        return instance;
+    }
+
+    TaskScheduler::shared().submit(streaming_, [this, path, id]() {
+                                       streamModel(path, id);
+                                   });
+
+    return instance;
+}
+
+bool ResourceManager::commitStreamed()
+{
+    vector<function<void()> > commits;
+    {
+        lock_guard<mutex> lock(commitMutex_);
+        commits.swap(commits_);
+    }
+
+    for (auto& commit: commits)
+    {
+        commit();
+    }
+
+    return !commits.empty();
+}
+
+void ResourceManager::postCommit(function<void()>commit)
+{
+    lock_guard<mutex> lock(commitMutex_);
+    commits_.push_back(std::move(commit));
+}
+
+void ResourceManager::streamModel(const string& path, const string& id)
+{
+    Model model(this, true);
+    model.loadModel(path);
+
+    SceneNode* root = model.getSceneNode();
+
+    if (root == nullptr)
+    {
+        postCommit([this, path, id]() {
+                       cout << "Unable to load resource: " << path << endl;
+                       streamingModels_.erase(id);
+                   });
+
+        return;
+    }
+
+    const vector<Model::TextureRequest>& requests  = model.getTextureRequests();
+    const vector<DrawableObject *>     & drawables = model.getDrawableObjects();
+
+    // Each file is decoded once, in parallel with the simplification below
+    TaskScheduler& scheduler = TaskScheduler::shared();
+    TaskGroup      textureTasks;
+    TaskGroup      lodTasks;
+    vector<string> paths;
+    vector<string> typeNames;
+
+    for (auto& request: requests)
+    {
+        if (find(paths.begin(), paths.end(), request.path) == paths.end())
+        {
+            paths.push_back(request.path);
+            typeNames.push_back(request.typeName);
+        }
+    }
+
+    vector<Geometry::Texture *> textures(paths.size(), nullptr);
+
+    for (int i = 0; i < paths.size(); i++)
+    {
+        scheduler.submit(textureTasks, [this, &paths, &textures, i]() {
+                             textures[i] = TextureFromFile(paths[i]);
+                         });
+    }
+
+    for (auto drawable: drawables)
+    {
+        for (auto geometry: drawable->geometries)
+        {
+            scheduler.submit(lodTasks, [this, geometry]() {
+                                 generateLods(geometry);
+                             });
+        }
+    }
+
+    // Geometries show up as soon as their levels are ready, untextured
+    scheduler.wait(lodTasks);
+
+    postCommit([this, root, drawables, id]() {
+                   for (int i = 0; i < drawables.size(); i++)
+                   {
+                       loadedObjects_.insert_or_assign(id + "#" + to_string(i), drawables[i]);
+                   }
+
+                   loadedModels_.insert_or_assign(id, root);
+
+                   auto streaming = streamingModels_.find(id);
+
+                   if (streaming != streamingModels_.end())
+                   {
+                       for (auto instance: streaming->second)
+                       {
+                           instance->addChild(root->clone());
+                       }
+                   }
+               });
+
+    scheduler.wait(textureTasks);
+
+    postCommit([this, requests, drawables, paths, typeNames, textures, id]() {
+                   vector<TextureResource *> resources(paths.size(), nullptr);
+                   int loaded = 0;
+
+                   // Files loaded meanwhile by another model are kept
+                   for (int i = 0; i < paths.size(); i++)
+                   {
+                       resources[i] = getTextureResource(paths[i]);
+
+                       if (resources[i] == nullptr)
+                       {
+                           resources[i] = addTextureResource(textures[i], typeNames[i], paths[i]);
+                       }
+                       else
+                       {
+                           delete textures[i];
+                       }
+                   }
+
+                   for (auto& request: requests)
+                   {
+                       auto resource = resources[find(paths.begin(), paths.end(), request.path) - paths.begin()];
+
+                       if (resource != nullptr)
+                       {
+                           // Levels were simplified before the textures arrived
+                           request.geometry->textures.push_back(resource);
+
+                           for (auto lod: request.geometry->lods)
+                           {
+                               lod->textures.push_back(resource);
+                           }
+
+                           loaded++;
+                       }
+                   }
+
+                   // Same rule as a blocking load
+                   for (auto drawable: drawables)
+                   {
+                       drawable->useTexture = loaded > 0;
+                   }
+
+                   streamingModels_.erase(id);
+               });
 }
 
 DrawableObject * ResourceManager::loadTexturedQuad(const string& texturePath, const glm::mat4& modelMatrix, string id)
@@ -224,6 +494,39 @@ DrawableObject * ResourceManager::loadTexturedQuad(const string& texturePath, co
     return loadedQuad;
 }
 
+void ResourceManager::generateLods(GeometryResource* geometry)
+{
+    GeometryResource* previous = geometry;
+
+    for (int level = 0; level < LOD_MAX_LEVELS; level++)
+    {
+        int faces  = static_cast<int>(previous->faces.size());
+        int target = static_cast<int>(faces * LOD_REDUCTION);
+
+        if (target < LOD_MIN_FACES)
+        {
+            break;
+        }
+
+        // Simplify from the previous level so each step stays cheap
+        MeshSimplifier    simplifier(previous);
+        GeometryResource* lod = simplifier.simplify(target);
+
+        // Stop when seams and borders leave nothing to collapse
+        if ((lod == nullptr) || (lod->faces.size() > faces * (1 + LOD_REDUCTION) / 2))
+        {
+            delete lod;
+            break;
+        }
+
+        lod->boundCenter = geometry->boundCenter;
+        lod->boundRadius = geometry->boundRadius;
+        lod->computeFacePlanes();
+        geometry->lods.push_back(lod);
+        previous = lod;
+    }
+}
+
 Geometry::Texture * ResourceManager::TextureFromFile(const string& path)
 {
     cout << "loading texture: " << path << endl;
@@ -0,0 +1,272 @@
+#include "SceneGraph.h"
+
+#include <algorithm>
+#include <limits>
+using namespace std;
+
+#include "ResourceManager.h"
+
+// Smallest sphere around two spheres, a negative radius is empty
+inline void mergeSphere(glm::vec3& center, float& radius, const glm::vec3& otherCenter, float otherRadius)
+{
+    if (otherRadius < 0)
+    {
+        return;
+    }
+
+    float distance = glm::length(otherCenter - center);
+
+    if ((radius < 0) || (distance + radius <= otherRadius))
+    {
+        center = otherCenter;
+        radius = otherRadius;
+    }
+    else if (distance + otherRadius > radius)
+    {
+        float merged = (distance + radius + otherRadius) * 0.5f;
+        center += (otherCenter - center) * ((merged - radius) / distance);
+        radius  = merged;
+    }
+}
+
+SceneNode::~SceneNode()
+{
+    for (SceneNode* child : children_)
+    {
+        delete child;
+    }
+}
+
+SceneNode * SceneNode::addChild(SceneNode* child)
+{
+    child->parent_ = this;
+    children_.push_back(child);
+    child->markDirty();
+
+    return child;
+}
+
+SceneNode * SceneNode::clone() const
+{
+    SceneNode* copy = new SceneNode(drawable_, local_);
+
+    for (SceneNode* child : children_)
+    {
+        copy->addChild(child->clone());
+    }
+
+    return copy;
+}
+
+void SceneNode::setLocalTransform(const glm::mat4& localTransform)
+{
+    local_ = localTransform;
+    markDirty();
+}
+
+void SceneNode::markDirty()
+{
+    dirty_ = true;
+
+    for (SceneNode* node = parent_; (node != nullptr) && !node->subtreeDirty_; node = node->parent_)
+    {
+        node->subtreeDirty_ = true;
+    }
+}
+
+void SceneGraph::update(const glm::mat4& viewProjection)
+{
+    viewChanged_ = viewProjection != viewProjection_;
+    changedNodes_.clear();
+    updatedCount_ = 0;
+
+    float infinity = numeric_limits<float>::max();
+
+    dirtyBounds_ = viewChanged_ ? glm::vec4(-infinity, -infinity, infinity, infinity) :
+                   glm::vec4(infinity, infinity, -infinity, -infinity);
+
+    if (viewChanged_)
+    {
+        viewProjection_ = viewProjection;
+        computeFrustum(viewProjection, frustum_);
+    }
+
+    if (viewChanged_ || root_->dirty_ || root_->subtreeDirty_)
+    {
+        updateNode(root_, glm::mat4(1.0f), false);
+    }
+
+    // A still view over unmoved nodes keeps the last visible list
+    visibleStale_ = visibleStale_ || viewChanged_ || !changedNodes_.empty();
+}
+
+void SceneGraph::updateNode(SceneNode* node, const glm::mat4& parentWorld, bool parentChanged)
+{
+    bool changed = parentChanged || node->dirty_;
+
+    if (changed)
+    {
+        // The area it covered has to be redrawn as well
+        addDirtyBounds(node);
+
+        node->world_ = parentWorld * node->local_;
+        changedNodes_.push_back(node);
+    }
+
+    if (changed || viewChanged_)
+    {
+        node->mvp_ = viewProjection_ * node->world_;
+        updatedCount_++;
+    }
+
+    // Clean subtrees keep everything when the view is unchanged
+    for (SceneNode* child : node->children_)
+    {
+        if (changed || viewChanged_ || child->dirty_ || child->subtreeDirty_)
+        {
+            updateNode(child, node->world_, changed);
+        }
+    }
+
+    if (changed || node->subtreeDirty_)
+    {
+        updateBounds(node);
+    }
+
+    if (changed)
+    {
+        addDirtyBounds(node);
+    }
+
+    node->dirty_        = false;
+    node->subtreeDirty_ = false;
+}
+
+void SceneGraph::updateBounds(SceneNode* node)
+{
+    node->boundRadius_ = -1.0f;
+
+    if (node->drawable_ != nullptr)
+    {
+        const glm::mat4& world = node->world_;
+        float            scale = std::max(glm::length(glm::vec3(world[0])),
+                                          std::max(glm::length(glm::vec3(world[1])), glm::length(glm::vec3(world[2]))));
+
+        for (GeometryResource* geometry : node->drawable_->geometries)
+        {
+            mergeSphere(node->boundCenter_, node->boundRadius_,
+                        glm::vec3(world * glm::vec4(geometry->boundCenter, 1.0f)), geometry->boundRadius * scale);
+        }
+    }
+
+    for (SceneNode* child : node->children_)
+    {
+        mergeSphere(node->boundCenter_, node->boundRadius_, child->boundCenter_, child->boundRadius_);
+    }
+}
+
+void SceneGraph::addDirtyBounds(const SceneNode* node)
+{
+    if (viewChanged_ || (node->boundRadius_ < 0))
+    {
+        return;
+    }
+
+    glm::vec4 bounds = projectBounds(node);
+
+    dirtyBounds_ = glm::vec4(min(dirtyBounds_.x, bounds.x), min(dirtyBounds_.y, bounds.y),
+                             max(dirtyBounds_.z, bounds.z), max(dirtyBounds_.w, bounds.w));
+}
+
+glm::vec4 SceneGraph::projectBounds(const SceneNode* node) const
+{
+    float     infinity = numeric_limits<float>::max();
+    glm::vec4 bounds   = glm::vec4(infinity, infinity, -infinity, -infinity);
+
+    // Corners of the box around the sphere
+    for (int i = 0; i < 8; i++)
+    {
+        glm::vec3 corner = node->boundCenter_ + node->boundRadius_ *
+                           glm::vec3(i & 1 ? 1.0f : -1.0f, i & 2 ? 1.0f : -1.0f, i & 4 ? 1.0f : -1.0f);
+        glm::vec4 point  = viewProjection_ * glm::vec4(corner, 1.0f);
+
+        // Crossing the camera plane, it may cover anything
+        if (point.w <= 0)
+        {
+            return glm::vec4(-infinity, -infinity, infinity, infinity);
+        }
+
+        bounds = glm::vec4(min(bounds.x, point.x / point.w), min(bounds.y, point.y / point.w),
+                           max(bounds.z, point.x / point.w), max(bounds.w, point.y / point.w));
+    }
+
+    return bounds;
+}
+
+void SceneGraph::computeFrustum(const glm::mat4& viewProjection, glm::vec4 frustum[6])
+{
+    // Frustum planes from the rows of the view projection
+    for (int i = 0; i < 3; i++)
+    {
+        glm::vec4 row = glm::vec4(viewProjection[0][i], viewProjection[1][i], viewProjection[2][i], viewProjection[3][i]);
+        glm::vec4 w   = glm::vec4(viewProjection[0][3], viewProjection[1][3], viewProjection[2][3], viewProjection[3][3]);
+
+        frustum[i * 2]     = w + row;
+        frustum[i * 2 + 1] = w - row;
+    }
+
+    for (int i = 0; i < 6; i++)
+    {
+        frustum[i] /= glm::length(glm::vec3(frustum[i]));
+    }
+}
+
+const vector<SceneNode *>& SceneGraph::collectVisible()
+{
+    if (!visibleStale_)
+    {
+        return visibleNodes_;
+    }
+
+    visibleNodes_.clear();
+    collectNode(root_, frustum_, visibleNodes_);
+    visibleStale_ = false;
+
+    return visibleNodes_;
+}
+
+void SceneGraph::collectVisible(const glm::mat4& viewProjection, vector<SceneNode *>& visible) const
+{
+    glm::vec4 frustum[6];
+
+    computeFrustum(viewProjection, frustum);
+    visible.clear();
+    collectNode(root_, frustum, visible);
+}
+
+void SceneGraph::collectNode(SceneNode* node, const glm::vec4 frustum[6], vector<SceneNode *>& visible)
+{
+    if (node->boundRadius_ < 0)
+    {
+        return;
+    }
+
+    // Skip the whole subtree when its bounds are outside a plane
+    for (int i = 0; i < 6; i++)
+    {
+        if (glm::dot(glm::vec3(frustum[i]), node->boundCenter_) + frustum[i].w < -node->boundRadius_)
+        {
+            return;
+        }
+    }
+
+    if (node->drawable_ != nullptr)
+    {
+        visible.push_back(node);
+    }
+
+    for (SceneNode* child : node->children_)
+    {
+        collectNode(child, frustum, visible);
+    }
+}
@@ -0,0 +1,26 @@
+#include "SpanKernels.h"
+
+// Instances of one shade policy, without and with lighting
+#define SPAN_KERNEL_ROW(Shade) \
+    { spanKernel<Shade, false>, spanKernel<Shade, true> }
+
+const SpanKernel SPAN_KERNELS[SPAN_SHADE_COUNT][2] = {
+    SPAN_KERNEL_ROW(FlatShade),
+    SPAN_KERNEL_ROW(DeferredFlatShade),
+    SPAN_KERNEL_ROW(DeferredTextureShade),
+    SPAN_KERNEL_ROW(TextureShade<NearestSampler>),
+    SPAN_KERNEL_ROW(TextureShade<BilinearSampler>),
+    SPAN_KERNEL_ROW(TextureShade<LayeredSampler<NearestSampler> >),
+    SPAN_KERNEL_ROW(TextureShade<LayeredSampler<BilinearSampler> >),
+    SPAN_KERNEL_ROW(CachedTextureShade<NearestSampler>),
+    SPAN_KERNEL_ROW(CachedTextureShade<BilinearSampler>),
+    SPAN_KERNEL_ROW(CachedTextureShade<LayeredSampler<NearestSampler> >),
+    SPAN_KERNEL_ROW(CachedTextureShade<LayeredSampler<BilinearSampler> >)
+};
+
+const TexelSampler TEXEL_SAMPLERS[SPAN_FILTER_COUNT] = {
+    samplePolygon<NearestSampler>,
+    samplePolygon<BilinearSampler>,
+    samplePolygon<LayeredSampler<NearestSampler> >,
+    samplePolygon<LayeredSampler<BilinearSampler> >
+};
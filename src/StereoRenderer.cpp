@@ -0,0 +1,249 @@
+#include "StereoRenderer.h"
+
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <chrono>
+using namespace std;
+
+#include "ResourceManager.h"
+#include "TaskScheduler.h"
+#include "ZBufferScanLine.h"
+
+StereoRenderer::StereoRenderer(SceneGraph& scene, int width, int height, int samples, float near, float far) :
+    scene_(scene), width_(width), height_(height), samples_(samples), lights_(getDefaultLights())
+{
+    for (int eye = 0; eye < 2; eye++)
+    {
+        eyes_[eye] = new ZBufferScanLine(width, height, near, far, samples);
+        eyes_[eye]->setLighting(true);
+    }
+}
+
+StereoRenderer::~StereoRenderer()
+{
+    delete eyes_[0];
+    delete eyes_[1];
+}
+
+void StereoRenderer::render(const glm::mat4& view, const glm::mat4& projection, GLubyte* left, GLubyte* right)
+{
+    auto start = chrono::steady_clock::now();
+
+    // Each eye moves half the separation sideways and shears its frustum
+    // back to the center one at the convergence distance. In clip space
+    // that only adds offset + slope * w to x, as w = -z in view space
+    const float half = separation_ * 0.5f;
+    glm::vec4   frustums[2][6];
+
+    for (int eye = 0; eye < 2; eye++)
+    {
+        float side = eye == 0 ? -1.0f : 1.0f;
+
+        eyeView_[eye]              = glm::translate(glm::mat4(1.0f), glm::vec3(-side * half, 0.0f, 0.0f)) * view;
+        eyeProjection_[eye]        = projection;
+        eyeProjection_[eye][2][0] -= side * projection[0][0] * half / convergence_;
+        clipOffset_[eye]           = -side * projection[0][0] * half;
+        clipSlope_[eye]            = side * projection[0][0] * half / convergence_;
+
+        SceneGraph::computeFrustum(eyeProjection_[eye] * eyeView_[eye], frustums[eye]);
+    }
+
+    viewProjection_ = projection * view;
+    scene_.update(viewProjection_);
+
+    // One traversal for both eyes, then the geometries are independent
+    geometries_.clear();
+    vertexCount_ = 0;
+    faceCount_   = 0;
+    collectNode(scene_.getRoot(), frustums, 3);
+
+    clip_.resize(vertexCount_);
+    faceViews_.resize(faceCount_);
+
+    TaskScheduler& scheduler = TaskScheduler::shared();
+    auto           share     = [this](int first, int last) {
+                                   for (int i = first; i < last; i++)
+                                   {
+                                       shareGeometry(geometries_[i]);
+                                   }
+                               };
+
+    scheduler.parallelFor(0, static_cast<int>(geometries_.size()), 1, share);
+
+    statistics_.sharedMs = chrono::duration<float, milli>(chrono::steady_clock::now() - start).count();
+
+    TaskGroup eyes;
+
+    scheduler.submit(eyes, [this, left]() {
+                         renderEye(0, left);
+                     });
+    scheduler.submit(eyes, [this, right]() {
+                         renderEye(1, right);
+                     });
+    scheduler.wait(eyes);
+
+    statistics_.frameMs = chrono::duration<float, milli>(chrono::steady_clock::now() - start).count();
+}
+
+void StereoRenderer::collectNode(SceneNode* node, const glm::vec4 frustums[2][6], int views)
+{
+    if (node->getBoundRadius() < 0)
+    {
+        return;
+    }
+
+    // Eyes that see nothing of the subtree drop out of it
+    for (int eye = 0; eye < 2; eye++)
+    {
+        for (int i = 0; (views & (1 << eye)) && (i < 6); i++)
+        {
+            if (glm::dot(glm::vec3(frustums[eye][i]), node->getBoundCenter()) + frustums[eye][i].w < -node->getBoundRadius())
+            {
+                views &= ~(1 << eye);
+            }
+        }
+    }
+
+    if (views == 0)
+    {
+        return;
+    }
+
+    if (node->getDrawable() != nullptr)
+    {
+        for (auto geometry : node->getDrawable()->geometries)
+        {
+            geometries_.push_back({ node, geometry, views, vertexCount_, faceCount_ });
+            vertexCount_ += static_cast<int>(geometry->vertices.size());
+            faceCount_   += static_cast<int>(geometry->faces.size());
+        }
+    }
+
+    for (SceneNode* child : node->getChildren())
+    {
+        collectNode(child, frustums, views);
+    }
+}
+
+void StereoRenderer::shareGeometry(const SharedGeometry& shared)
+{
+    const glm::mat4 & world    = shared.node->getWorldTransform();
+    glm::mat4         mvp      = viewProjection_ * world;
+    glm::mat4         toObject = glm::inverse(world);
+    GeometryResource* geometry = shared.geometry;
+    glm::vec4         eyes[2];
+
+    for (int eye = 0; eye < 2; eye++)
+    {
+        eyes[eye] = toObject * glm::inverse(eyeView_[eye])[3];
+    }
+
+    // Every vertex once, instead of once per face and eye
+    glm::vec3* clip = clip_.data() + shared.firstVertex;
+
+    for (size_t i = 0; i < geometry->vertices.size(); i++)
+    {
+        glm::vec4 point = mvp * glm::vec4(geometry->vertices[i]->position, 1.0f);
+        clip[i] = glm::vec3(point.x, point.y, point.w);
+    }
+
+    // Both eyes in one sweep over the planes. Rasterizer::isBackFace gets
+    // the eye scaled by the determinant of the projection, which is negative,
+    // so the test flips for the plain eye position
+    unsigned char* views = faceViews_.data() + shared.firstFace;
+
+    for (size_t i = 0; i < geometry->faces.size(); i++)
+    {
+        const glm::vec4& plane = geometry->faces[i]->plane;
+
+        views[i] = 0;
+
+        for (int eye = 0; eye < 2; eye++)
+        {
+            if ((shared.views & (1 << eye)) && (glm::dot(plane, eyes[eye]) > 0))
+            {
+                views[i] |= 1 << eye;
+            }
+        }
+    }
+}
+
+void StereoRenderer::renderEye(int eye, GLubyte* image)
+{
+    auto start = chrono::steady_clock::now();
+
+    ZBufferScanLine& context = *eyes_[eye];
+    glm::mat4        camera  = glm::inverse(eyeView_[eye]);
+    const float      offset  = clipOffset_[eye];
+    const float      slope   = clipSlope_[eye];
+    const float      scaleX  = static_cast<float>(width_ * samples_ - 1); // In samples, as insertPolygon
+    const float      scaleY  = static_cast<float>(height_ * samples_ - 1);
+
+    context.reset();
+    context.setViewDir(-glm::vec3(camera[2]));
+    context.setViewProjection(eyeProjection_[eye] * eyeView_[eye]);
+    context.setLights(lights_, glm::vec3(camera[3]));
+
+    vector<glm::vec3> projected;
+
+    for (auto& shared : geometries_)
+    {
+        if (!(shared.views & (1 << eye)))
+        {
+            continue;
+        }
+
+        GeometryResource   * geometry = shared.geometry;
+        bool                 textured = shared.node->getDrawable()->useTexture;
+        const glm::vec3    * clip     = clip_.data() + shared.firstVertex;
+        const unsigned char* views    = faceViews_.data() + shared.firstFace;
+
+        context.setModel(shared.node->getWorldTransform());
+
+        for (size_t i = 0; i < geometry->faces.size(); i++)
+        {
+            if (!(views[i] & (1 << eye)))
+            {
+                continue;
+            }
+
+            Geometry::Face* face  = geometry->faces[i];
+            bool            front = true; // Outcodes as in the batched setup
+            bool            left  = true;
+            bool            right = true;
+            bool            below = true;
+            bool            above = true;
+
+            projected.clear();
+
+            for (int index : face->indices)
+            {
+                const glm::vec3& point = clip[index];
+                glm::vec3        screen((point.x + offset + slope * point.z) / point.z, point.y / point.z, 1 / point.z);
+
+                screen.x = (screen.x + 0.5f) * scaleX;
+                screen.y = (screen.y + 0.5f) * scaleY;
+
+                front = front && (screen.z > 0);
+                left  = left && (screen.x < 0);
+                right = right && (screen.x > scaleX);
+                below = below && (screen.y < 0);
+                above = above && (screen.y > scaleY);
+
+                projected.push_back(screen);
+            }
+
+            // Clipping would drop every edge
+            if (front && (left || right || below || above))
+            {
+                continue;
+            }
+
+            context.insertProjectedPolygon(face, geometry, textured, projected);
+        }
+    }
+
+    context.draw(image);
+
+    statistics_.viewMs[eye] = chrono::duration<float, milli>(chrono::steady_clock::now() - start).count();
+}
@@ -0,0 +1,309 @@
+#include "TaskScheduler.h"
+
+#include <algorithm>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#elif defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+using namespace std;
+
+// Scheduler and deque of the calling thread, set for pool workers only
+static thread_local TaskScheduler* currentScheduler = nullptr;
+static thread_local int currentSlot = 0;
+
+// Group of the task the calling thread runs, parent of the groups it submits
+static thread_local TaskGroup* currentGroup = nullptr;
+
+static void pinCurrentThread(int core)
+{
+#ifdef _WIN32
+    SetThreadAffinityMask(GetCurrentThread(), DWORD_PTR(1) << core);
+#elif defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(core, &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#endif
+}
+
+TaskScheduler::TaskScheduler(int workers, bool pinThreads) :
+    sleeping_(0), stop_(false), queued_(0), maxQueued_(0), submitted_(0), executed_(0), stolen_(0)
+{
+    start(workers, pinThreads);
+}
+
+TaskScheduler::~TaskScheduler()
+{
+    stop();
+}
+
+TaskScheduler& TaskScheduler::shared()
+{
+    static TaskScheduler scheduler;
+
+    return scheduler;
+}
+
+void TaskScheduler::configure(int workers, bool pinThreads)
+{
+    stop();
+    start(workers, pinThreads);
+}
+
+void TaskScheduler::start(int workers, bool pinThreads)
+{
+    if (workers < 0)
+    {
+        workers = max(static_cast<int>(thread::hardware_concurrency()) - 1, 0);
+    }
+
+    queues_.clear();
+
+    for (int i = 0; i <= workers; i++)
+    {
+        queues_.emplace_back(new TaskQueue);
+    }
+
+    stop_ = false;
+
+    for (int i = 0; i < workers; i++)
+    {
+        threads_.emplace_back(&TaskScheduler::workerLoop, this, i + 1, pinThreads);
+    }
+}
+
+void TaskScheduler::stop()
+{
+    {
+        lock_guard<mutex> lock(sleepMutex_);
+        stop_ = true;
+    }
+
+    wake_.notify_all();
+
+    for (auto& worker : threads_)
+    {
+        worker.join();
+    }
+
+    threads_.clear();
+}
+
+int TaskScheduler::getSlot() const
+{
+    return currentScheduler == this ? currentSlot : 0;
+}
+
+void TaskScheduler::submit(TaskGroup& group, function<void()> task)
+{
+    group.pending_++;
+    group.parent_ = currentGroup;
+    submitted_++;
+
+    TaskQueue& queue = *queues_[getSlot()];
+    {
+        lock_guard<mutex> lock(queue.mutex);
+        queue.tasks.push_back(Task());
+        queue.tasks.back().run   = std::move(task);
+        queue.tasks.back().group = &group;
+    }
+
+    int depth = ++queued_;
+    int deepest = maxQueued_;
+
+    while ((depth > deepest) && !maxQueued_.compare_exchange_weak(deepest, depth))
+    {}
+
+    // A worker going to sleep either sees the task or is counted here
+    if (sleeping_ > 0)
+    {
+        {
+            lock_guard<mutex> lock(sleepMutex_);
+        }
+
+        wake_.notify_one();
+    }
+}
+
+void TaskScheduler::wait(TaskGroup& group)
+{
+    int slot = getSlot();
+
+    while (group.pending_ > 0)
+    {
+        Task task;
+
+        if (findTask(slot, task, &group))
+        {
+            runTask(task);
+        }
+        else
+        {
+            // The remaining tasks run on other threads
+            this_thread::yield();
+        }
+    }
+}
+
+void TaskScheduler::parallelFor(int begin, int end, int grain, const function<void(int, int)>& body)
+{
+    grain = max(grain, 1);
+
+    // Nothing to share
+    if (threads_.empty() || (end - begin <= grain))
+    {
+        if (begin < end)
+        {
+            body(begin, end);
+        }
+
+        return;
+    }
+
+    TaskGroup group;
+
+    for (int first = begin; first < end; first += grain)
+    {
+        int last = min(first + grain, end);
+
+        submit(group, [&body, first, last]() {
+                   body(first, last);
+               });
+    }
+
+    wait(group);
+}
+
+bool TaskScheduler::findTask(int slot, Task& task, TaskGroup* scope)
+{
+    if (queued_ == 0)
+    {
+        return false;
+    }
+
+    auto inScope = [scope](const Task& candidate)
+                   {
+                       for (TaskGroup* group = candidate.group; group != nullptr; group = group->parent_)
+                       {
+                           if (group == scope)
+                           {
+                               return true;
+                           }
+                       }
+                       return scope == nullptr;
+                   };
+
+    const int count = static_cast<int>(queues_.size());
+
+    for (int i = 0; i < count; i++)
+    {
+        int        victim = (slot + i) % count;
+        TaskQueue& queue  = *queues_[victim];
+
+        lock_guard<mutex> lock(queue.mutex);
+
+        if (i == 0)
+        {
+            auto found = find_if(queue.tasks.rbegin(), queue.tasks.rend(), inScope);
+
+            if (found == queue.tasks.rend())
+            {
+                continue;
+            }
+
+            task = std::move(*found);
+            queue.tasks.erase(next(found).base());
+        }
+        else
+        {
+            auto found = find_if(queue.tasks.begin(), queue.tasks.end(), inScope);
+
+            if (found == queue.tasks.end())
+            {
+                continue;
+            }
+
+            task = std::move(*found);
+            queue.tasks.erase(found);
+            stolen_++;
+        }
+
+        queued_--;
+
+        return true;
+    }
+
+    return false;
+}
+
+void TaskScheduler::runTask(Task& task)
+{
+    // Tasks run nested inside a wait, restore the outer group afterwards
+    TaskGroup* outer = currentGroup;
+
+    currentGroup = task.group;
+    task.run();
+    currentGroup = outer;
+
+    executed_++;
+    task.group->pending_--;
+}
+
+void TaskScheduler::workerLoop(int slot, bool pin)
+{
+    currentScheduler = this;
+    currentSlot      = slot;
+
+    if (pin)
+    {
+        pinCurrentThread(slot % max(static_cast<int>(thread::hardware_concurrency()), 1));
+    }
+
+    while (true)
+    {
+        Task task;
+
+        if (findTask(slot, task))
+        {
+            runTask(task);
+            continue;
+        }
+
+        unique_lock<mutex> lock(sleepMutex_);
+        sleeping_++;
+        wake_.wait(lock, [this]() {
+                       return stop_ || (queued_ > 0);
+                   });
+        sleeping_--;
+
+        if (stop_)
+        {
+            return;
+        }
+    }
+}
+
+TaskStatistics TaskScheduler::getStatistics() const
+{
+    TaskStatistics statistics;
+    statistics.submitted = submitted_;
+    statistics.executed  = executed_;
+    statistics.stolen    = stolen_;
+    statistics.queued    = queued_;
+    statistics.maxQueued = maxQueued_;
+
+    return statistics;
+}
+
+void TaskScheduler::resetStatistics()
+{
+    submitted_ = 0;
+    executed_  = 0;
+    stolen_    = 0;
+    maxQueued_ = queued_.load();
+}
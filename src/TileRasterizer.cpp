@@ -0,0 +1,505 @@
+#include "TileRasterizer.h"
+
+#include <algorithm>
+#include <limits>
+using namespace std;
+
+#include "HelperTools.h"
+#include "ResourceManager.h"
+#include "TaskScheduler.h"
+
+static const int TILE_SETUP_CHUNK = 256; // Faces set up by one task
+
+TileRasterizer::TileRasterizer(int width, int height, GLfloat near, GLfloat far, int samples, int tileSize) :
+    Rasterizer(near, far), tileSize_(tileSize)
+{
+    resize(width, height, samples);
+}
+
+void TileRasterizer::reset()
+{
+    triangles_.clear();
+
+    for (auto& bin : bins_)
+    {
+        bin.clear();
+    }
+
+    numPolygon_ = 0;
+}
+
+void TileRasterizer::resize(int width, int height, int samples)
+{
+    outWidth_  = width;
+    outHeight_ = height;
+    samples_   = samples;
+    tilesX_    = (width + tileSize_ - 1) / tileSize_;
+    tilesY_    = (height + tileSize_ - 1) / tileSize_;
+
+    // Bins only grow, so their storage is reused between resolutions
+    if (bins_.size() < static_cast<size_t>(tilesX_ * tilesY_))
+    {
+        bins_.resize(tilesX_ * tilesY_);
+    }
+
+    reset();
+}
+
+void TileRasterizer::insertPolygon(Geometry::Face* face, GeometryResource* geometry, bool useTexture)
+{
+    if (setupChunks_.empty())
+    {
+        setupChunks_.resize(1);
+    }
+
+    TileSetupChunk& chunk = setupChunks_[0];
+
+    chunk.triangles.clear();
+    chunk.polygonEnds.clear();
+    setupPolygon(face, geometry, useTexture, chunk);
+    binChunk(chunk);
+}
+
+void TileRasterizer::insertPolygons(GeometryResource* geometry, bool useTexture)
+{
+    const int faces  = static_cast<int>(geometry->faces.size());
+    const int chunks = (faces + TILE_SETUP_CHUNK - 1) / TILE_SETUP_CHUNK;
+
+    if (setupChunks_.size() < static_cast<size_t>(chunks))
+    {
+        setupChunks_.resize(chunks);
+    }
+
+    // Projection and setup are independent per face
+    TaskScheduler::shared().parallelFor(0, chunks, 1, [&](int first, int last) {
+                                            for (int c = first; c < last; c++)
+                                            {
+                                                TileSetupChunk& chunk = setupChunks_[c];
+                                                int             end   = min(faces, (c + 1) * TILE_SETUP_CHUNK);
+
+                                                chunk.triangles.clear();
+                                                chunk.polygonEnds.clear();
+
+                                                for (int i = c * TILE_SETUP_CHUNK; i < end; i++)
+                                                {
+                                                    setupPolygon(geometry->faces[i], geometry, useTexture, chunk);
+                                                }
+                                            }
+                                        });
+
+    // Binning keeps the submission order, so ties resolve as with insertPolygon
+    for (int c = 0; c < chunks; c++)
+    {
+        binChunk(setupChunks_[c]);
+    }
+}
+
+void TileRasterizer::binChunk(const TileSetupChunk& chunk)
+{
+    int begin = 0;
+
+    for (int end : chunk.polygonEnds)
+    {
+        bool inserted = false;
+
+        for (int i = begin; i < end; i++)
+        {
+            inserted |= binTriangle(chunk.triangles[i]);
+        }
+
+        if (inserted)
+        {
+            numPolygon_++;
+        }
+
+        begin = end;
+    }
+}
+
+void TileRasterizer::setupPolygon(Geometry::Face* face, GeometryResource* geometry, bool useTexture,
+                                  TileSetupChunk& chunk)
+{
+    int count = static_cast<int>(face->indices.size());
+
+    if ((count < 3) || isBackFace(face))
+    {
+        return;
+    }
+
+    // Same screen mapping as the scanline engine, in pixels instead of samples
+    float scaleX = static_cast<float>(outWidth_ * samples_ - 1) / samples_;
+    float scaleY = static_cast<float>(outHeight_ * samples_ - 1) / samples_;
+
+    vector<glm::vec4> clip(count);
+    vector<glm::vec2> texCoords(count);
+    bool              crossing = false;
+
+    for (int i = 0; i < count; i++)
+    {
+        Geometry::Vertice* vertice = face->vertices[face->indices[i]];
+
+        clip[i]   = mvp_ * glm::vec4(vertice->position, 1.0f);
+        crossing |= clip[i].w < near_;
+
+        if (useTexture)
+        {
+            texCoords[i] = vertice->texCoord;
+        }
+    }
+
+    // Cut what reaches behind the near plane, attributes are linear in
+    // clip space so both interpolate with the same factor
+    if (crossing)
+    {
+        vector<glm::vec4> clipped;
+        vector<glm::vec2> clippedTex;
+
+        for (int i = 0; i < count; i++)
+        {
+            int  next   = (i + 1) % count;
+            bool inside = clip[i].w >= near_;
+
+            if (inside)
+            {
+                clipped.push_back(clip[i]);
+                clippedTex.push_back(texCoords[i]);
+            }
+
+            if (inside != (clip[next].w >= near_))
+            {
+                float t = (near_ - clip[i].w) / (clip[next].w - clip[i].w);
+
+                clipped.push_back(glm::mix(clip[i], clip[next], t));
+                clippedTex.push_back(glm::mix(texCoords[i], texCoords[next], t));
+            }
+        }
+
+        if (clipped.size() < 3)
+        {
+            return;
+        }
+
+        clip.swap(clipped);
+        texCoords.swap(clippedTex);
+        count = static_cast<int>(clip.size());
+    }
+
+    vector<glm::vec3> projected(count);
+
+    for (int i = 0; i < count; i++)
+    {
+        const glm::vec4& point = clip[i];
+
+        projected[i] = glm::vec3((point.x / point.w + 0.5f) * scaleX,
+                                 (point.y / point.w + 0.5f) * scaleY,
+                                 1 / point.w);
+    }
+
+    Pixel color = packPixel(face->vertices[face->indices[0]]->color);
+
+    vector<TextureResource *>* textures = useTexture ? &geometry->textures : nullptr;
+
+    // Fan triangulation
+    for (int i = 1; i + 1 < count; i++)
+    {
+        glm::vec3 p[3]   = { projected[0], projected[i], projected[i + 1] };
+        glm::vec2 tex[3] = { texCoords[0], texCoords[i], texCoords[i + 1] };
+
+        chunk.triangles.emplace_back();
+
+        if (!setupTriangle(p, tex, color, textures, chunk.triangles.back()))
+        {
+            chunk.triangles.pop_back();
+        }
+    }
+
+    chunk.polygonEnds.push_back(static_cast<int>(chunk.triangles.size()));
+}
+
+bool TileRasterizer::setupTriangle(const glm::vec3* p, const glm::vec2* tex,
+                                   Pixel color, vector<TextureResource *>* textures, TileTriangle& tri)
+{
+    // Backface culling (counter-clockwise faces are front faces)
+    float det = (p[1].x - p[0].x) * (p[2].y - p[0].y) - (p[2].x - p[0].x) * (p[1].y - p[0].y);
+
+    if (det < FLT_EPS)
+    {
+        return false;
+    }
+
+    // Bounding box clipped to the screen
+    tri.minX = max(0, static_cast<int>(floor(min(p[0].x, min(p[1].x, p[2].x)))));
+    tri.maxX = min(outWidth_ - 1, static_cast<int>(ceil(max(p[0].x, max(p[1].x, p[2].x)))));
+    tri.minY = max(0, static_cast<int>(floor(min(p[0].y, min(p[1].y, p[2].y)))));
+    tri.maxY = min(outHeight_ - 1, static_cast<int>(ceil(max(p[0].y, max(p[1].y, p[2].y)))));
+
+    if ((tri.minX > tri.maxX) || (tri.minY > tri.maxY))
+    {
+        return false;
+    }
+
+    // Edge functions
+    for (int e = 0; e < 3; e++)
+    {
+        const glm::vec3& from = p[e];
+        const glm::vec3& to   = p[(e + 1) % 3];
+
+        tri.a[e]       = from.y - to.y;
+        tri.b[e]       = to.x - from.x;
+        tri.c[e]       = -(tri.a[e] * from.x + tri.b[e] * from.y);
+        tri.topLeft[e] = (to.y < from.y) || ((to.y == from.y) && (to.x < from.x));
+    }
+
+    // Interpolation planes (texture is perspective corrected through 1 / w)
+    tri.depth = computeScreenPlane(p, p[0].z, p[1].z, p[2].z, det);
+
+    if (textures != nullptr)
+    {
+        tri.texS = computeScreenPlane(p, tex[0].s * p[0].z, tex[1].s * p[1].z, tex[2].s * p[2].z, det);
+        tri.texT = computeScreenPlane(p, tex[0].t * p[0].z, tex[1].t * p[1].z, tex[2].t * p[2].z, det);
+    }
+
+    tri.color    = color;
+    tri.textures = textures;
+
+    return true;
+}
+
+bool TileRasterizer::binTriangle(const TileTriangle& tri)
+{
+    // Bin into every tile that is not fully outside one of the edges
+    int  index    = static_cast<int>(triangles_.size());
+    bool inserted = false;
+
+    for (int ty = tri.minY / tileSize_; ty <= tri.maxY / tileSize_; ty++)
+    {
+        for (int tx = tri.minX / tileSize_; tx <= tri.maxX / tileSize_; tx++)
+        {
+            float x0      = static_cast<float>(tx * tileSize_);
+            float y0      = static_cast<float>(ty * tileSize_);
+            bool  outside = false;
+
+            for (int e = 0; e < 3 && !outside; e++)
+            {
+                // Corner with the largest edge value
+                float x = tri.a[e] >= 0 ? x0 + tileSize_ : x0;
+                float y = tri.b[e] >= 0 ? y0 + tileSize_ : y0;
+                outside = tri.a[e] * x + tri.b[e] * y + tri.c[e] < 0;
+            }
+
+            if (!outside)
+            {
+                bins_[ty * tilesX_ + tx].push_back(index);
+                inserted = true;
+            }
+        }
+    }
+
+    if (inserted)
+    {
+        triangles_.push_back(tri);
+    }
+
+    return inserted;
+}
+
+void TileRasterizer::draw(GLubyte* buffer)
+{
+    TaskScheduler& scheduler   = TaskScheduler::shared();
+    const int      numTiles    = tilesX_ * tilesY_;
+    const int      tileSamples = tileSize_ * tileSize_ * samples_ * samples_;
+
+    // Tile local buffers, one set per scheduler slot
+    if (tileDepth_.size() < static_cast<size_t>(scheduler.getSlotCount()))
+    {
+        tileDepth_.resize(scheduler.getSlotCount());
+        tileColor_.resize(scheduler.getSlotCount());
+    }
+
+    scheduler.parallelFor(0, numTiles, 1, [&](int first, int last) {
+                              int slot = scheduler.getSlot();
+
+                              if (tileDepth_[slot].size() < static_cast<size_t>(tileSamples))
+                              {
+                                  tileDepth_[slot].resize(tileSamples);
+                                  tileColor_[slot].resize(tileSamples);
+                              }
+
+                              for (int i = first; i < last; i++)
+                              {
+                                  drawTile(i % tilesX_, i / tilesX_, buffer, tileDepth_[slot].data(),
+                                           tileColor_[slot].data());
+                              }
+
+#ifdef USE_SSE2
+                              _mm_sfence();
+#endif
+                          });
+}
+
+void TileRasterizer::drawTile(int tileX, int tileY, GLubyte* buffer, float* depth, Pixel* color)
+{
+    const int T          = tileSize_;
+    const int S          = samples_;
+    const int numSamples = S * S;
+    const int x0         = tileX * T;
+    const int y0         = tileY * T;
+    const int x1         = min(x0 + T, outWidth_);
+    const int y1         = min(y0 + T, outHeight_);
+
+    // Samples are stored as planes of T x T pixels, so 4 neighbouring pixels are contiguous
+    fill(depth, depth + T * T * numSamples, -numeric_limits<float>::max());
+    fill(color, color + T * T * numSamples, bgColor_);
+
+    for (int index : bins_[tileY * tilesX_ + tileX])
+    {
+        const TileTriangle& tri = triangles_[index];
+
+        int minX = max(x0, tri.minX);
+        int maxX = min(x1 - 1, tri.maxX);
+        int minY = max(y0, tri.minY);
+        int maxY = min(y1 - 1, tri.maxY);
+
+        // Walk groups of 4 pixels aligned to the tile
+        int startX = x0 + ((minX - x0) & ~3);
+
+        for (int y = minY; y <= maxY; y++)
+        {
+            for (int x = startX; x <= maxX; x += 4)
+            {
+                int offset = (y - y0) * T + (x - x0);
+                int passed[16]; // Lane mask of passing pixels per sample (up to 4 x 4 samples)
+                int covered = 0;
+
+                // Lanes inside the bounding box
+                int lanes = 0;
+
+                for (int lane = 0; lane < 4; lane++)
+                {
+                    if ((x + lane >= minX) && (x + lane <= maxX))
+                    {
+                        lanes |= 1 << lane;
+                    }
+                }
+
+#ifdef USE_SSE2
+                __m128 laneMask = _mm_castsi128_ps(_mm_set_epi32(lanes & 8 ? -1 : 0, lanes & 4 ? -1 : 0,
+                                                                 lanes & 2 ? -1 : 0, lanes & 1 ? -1 : 0));
+#endif
+
+                for (int k = 0; k < numSamples; k++)
+                {
+                    float sx     = x + (k % S + 0.5f) / S;
+                    float sy     = y + (k / S + 0.5f) / S;
+                    float* plane = depth + k * T * T + offset;
+
+#ifdef USE_SSE2
+                    __m128 px   = _mm_add_ps(_mm_set1_ps(sx), _mm_set_ps(3, 2, 1, 0));
+                    __m128 mask = laneMask;
+
+                    for (int e = 0; e < 3; e++)
+                    {
+                        __m128 value = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(tri.a[e]), px),
+                                                  _mm_set1_ps(tri.b[e] * sy + tri.c[e]));
+                        __m128 inside = tri.topLeft[e] ? _mm_cmpge_ps(value, _mm_setzero_ps())
+                                        : _mm_cmpgt_ps(value, _mm_setzero_ps());
+                        mask = _mm_and_ps(mask, inside);
+                    }
+
+                    __m128 z       = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(tri.depth.x), px),
+                                                _mm_set1_ps(tri.depth.y * sy + tri.depth.z));
+                    __m128 current = _mm_loadu_ps(plane);
+                    mask = _mm_and_ps(mask, _mm_cmpgt_ps(z, current));
+
+                    int pass = _mm_movemask_ps(mask);
+                    _mm_storeu_ps(plane, _mm_or_ps(_mm_and_ps(mask, z), _mm_andnot_ps(mask, current)));
+#else
+                    int pass = 0;
+
+                    for (int lane = 0; lane < 4; lane++)
+                    {
+                        float px     = sx + lane;
+                        bool  inside = (lanes >> lane) & 1;
+
+                        for (int e = 0; e < 3 && inside; e++)
+                        {
+                            float value = tri.a[e] * px + tri.b[e] * sy + tri.c[e];
+                            inside = tri.topLeft[e] ? value >= 0 : value > 0;
+                        }
+
+                        float z = tri.depth.x * px + tri.depth.y * sy + tri.depth.z;
+
+                        if (inside && (z > plane[lane]))
+                        {
+                            plane[lane] = z;
+                            pass       |= 1 << lane;
+                        }
+                    }
+#endif
+                    passed[k] = pass;
+                    covered  |= pass;
+                }
+
+                if (covered == 0)
+                {
+                    continue;
+                }
+
+                // Shade once per pixel and copy to the samples that passed
+                for (int lane = 0; lane < 4; lane++)
+                {
+                    if (!((covered >> lane) & 1))
+                    {
+                        continue;
+                    }
+
+                    Pixel shaded = tri.color;
+
+                    if (tri.textures != nullptr)
+                    {
+                        float     px = x + lane + 0.5f;
+                        float     py = y + 0.5f;
+                        float     z  = tri.depth.x * px + tri.depth.y * py + tri.depth.z;
+                        glm::vec2 texCoord((tri.texS.x * px + tri.texS.y * py + tri.texS.z) / z,
+                                           (tri.texT.x * px + tri.texT.y * py + tri.texT.z) / z);
+
+                        shaded = sampleTexture2D(texCoord, tri.textures, tri.color);
+                    }
+
+                    for (int k = 0; k < numSamples; k++)
+                    {
+                        if ((passed[k] >> lane) & 1)
+                        {
+                            color[k * T * T + offset + lane] = shaded;
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    // Resolve the samples into the frame buffer
+    for (int y = y0; y < y1; y++)
+    {
+        Pixel* dst = reinterpret_cast<Pixel *>(buffer) + y * outWidth_ + x0;
+
+        if (numSamples == 1)
+        {
+            streamCopy(dst, color + (y - y0) * T, x1 - x0);
+            continue;
+        }
+
+        for (int x = x0; x < x1; x++, dst++)
+        {
+            int      offset = (y - y0) * T + (x - x0);
+            PixelSum sum;
+
+            for (int k = 0; k < numSamples; k++)
+            {
+                sum.add(color[k * T * T + offset]);
+            }
+
+            *dst = sum.average(numSamples) | PIXEL_OPAQUE;
+        }
+    }
+}
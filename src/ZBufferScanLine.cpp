@@ -1,6 +1,7 @@
 #include "ZBufferScanLine.h"
 
 #include <algorithm>
+#include <chrono>
 #include <iostream>
 #include <limits>
 using namespace std;
@@ -8,6 +9,8 @@ using namespace std;
 #include "HelperTools.h"
 #include "ResourceManager.h"
 #include "Geometry.h"
+#include "SpanKernels.h"
+#include "TaskScheduler.h"
 
 #define SWAP(a, b) { auto tmp = a; a = b; b = tmp; }
 #define CLEARZ(a) glm::vec3(a.x, a.y, 0)
@@ -16,6 +19,10 @@ const unsigned char errorColor[4] = {
     255, 0, 0, 255
 };
 static const float  SAME_PIXEL_LIMIT = 0.5f;
+static const float  HISTORY_DEPTH_TOLERANCE = 0.05f; // Relative w difference of a reusable history pixel
+static const int    TRIANGLE_BATCH = 8;                // Front facing triangles projected together
+static const int    SMALL_TRIANGLE_LINES = 4;          // Taller triangles go through the active edge pairs
+static const int    RECONSTRUCT_BAND = 16;             // Rows rebuilt by one task
 
 // Clip xyz and uv
 inline ClipResult viewClipping(glm::vec3      & p1,
@@ -60,6 +67,21 @@ inline ClipResult viewClipping(glm::vec3      & p1,
     return result;
 }
 
+inline bool insideWindow(const glm::vec3* points, int count, int width, int height)
+{
+    for (int i = 0; i < count; i++)
+    {
+        const glm::vec3& p = points[i];
+
+        if ((p.x < 0) || (p.x > width - 1) || (p.y < 0) || (p.y > height - 1) || (p.z <= 0))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
 // TODO: Resolve corner clip problem
 inline void generateCorner(glm::vec3& corner, glm::vec2& texCorner, const glm::vec4* depthPlane,
                            const glm::vec3* p1, const glm::vec3* p2, const glm::vec2* tex1, const glm::vec2* tex2)
@@ -104,114 +126,428 @@ inline void generateCorner(glm::vec3& corner, glm::vec2& texCorner, const glm::v
     }
 }
 
-// Nearest interpolation
-inline void sampleTexture2D(glm::vec2& texCoord, vector<TextureResource *>* textures,
-                            unsigned char* dst, const glm::vec3 scale = glm::vec3(1.0f))
+ZBufferScanLine::ZBufferScanLine(int width, int height, GLfloat near, GLfloat far, int samples) :
+    Rasterizer(near, far)
+{
+    resize(width, height, samples);
+}
+
+ZBufferScanLine::~ZBufferScanLine()
 {
-    if (textures->empty())
+    reset();
+
+    for (ZPolygon* polygon : trianglePool_)
     {
-        return;
+        delete polygon;
     }
 
-    unsigned char color[4] = {
-        0, 0, 0, 0
-    };
+    delete[] zBuffer_;
+    delete[] sampleBuffer_;
+}
 
-    for (TextureResource* resource: *textures)
-    {
-        Geometry::Texture* texture = resource->texture;
-        int   width                = texture->width;
-        int   height               = texture->height;
-        int   channel              = texture->channel;
-        float s                    = clipUV(texCoord.s) * (width - 1);
-        float t                    = clipUV(texCoord.t) * (height - 1);
-        int   u                    = s - floor(s) < ceil(s) - s ?
-                                     static_cast<int>(floor(s)) : static_cast<int>(ceil(s));
-        int v = height - 1 - (t - floor(t) < ceil(t) - t ?
-                              static_cast<int>(floor(t)) : static_cast<int>(ceil(t)));
+void ZBufferScanLine::reset()
+{
+    // Clear active tables
+    activePolygonTable_.clear();
+    activeEdgePairTable_.clear();
 
-        colorAdd(color, texture->image + u * channel + v * width * channel);
+    // Clear polygons
+    // !! Demo behavior, not considering a second rendering
+    for (auto& entry : polygonBuckets_.entries())
+    {
+        delete entry.second;
     }
 
-    colorDiv(color, static_cast<int>(textures->size()));
+    polygonBuckets_.clear();
 
-    if (scale == glm::vec3(1.0f))
+    // Polygons of the triangle path stay allocated for the next frame
+    for (int i = 0; i < usedTriangles_; i++)
     {
-        colorCpy(dst, color);
+        recycleTriangle(*trianglePool_[i]);
     }
-    else
+
+    usedTriangles_ = 0;
+
+    // Pairs of a scene that was never drawn
+    if (!pairBuckets_.built())
     {
-        colorCpy(dst, color, scale);
+        for (auto& entry : pairBuckets_.entries())
+        {
+            delete entry.second;
+        }
     }
+
+    pairBuckets_.clear();
+    microSpans_.clear();
+
+    numPolygon_ = 0;
 }
 
-ZBufferScanLine::ZBufferScanLine(int width, int height, GLfloat near, GLfloat far) :
-    width_(width), height_(height),
-    near_(near), far_(far)
+void ZBufferScanLine::resize(int width, int height, int samples)
 {
-    // Allocate tables per scanline
-    polygonTables_.resize(height);
+    reset();
+
+    samples_   = samples;
+    outWidth_  = width;
+    outHeight_ = height;
+    width_     = width * samples;
+    height_    = height * samples;
+
+    // Buffers for one scanline
+    if (zBufferSize_ < width_)
+    {
+        delete[] zBuffer_;
+        zBuffer_     = new float[width_];
+        zBufferSize_ = width_;
+    }
+
+    if ((samples_ > 1) && (sampleBufferSize_ < width_ * samples_ * 4))
+    {
+        delete[] sampleBuffer_;
+        sampleBuffer_     = new GLubyte[width_ * samples_ * 4];
+        sampleBufferSize_ = width_ * samples_ * 4;
+    }
 
-    // Allocate buffers for one scanline
-    zBuffer_ = new float[width];
+    if (shadeCache_.size() < static_cast<size_t>(outWidth_))
+    {
+        shadeCache_.resize(outWidth_);
+    }
+
+    if (visPolygon_.size() < static_cast<size_t>(width_))
+    {
+        visPolygon_.resize(width_);
+        visTexCoord_.resize(width_);
+        surface_.resize(width_);
+        litPixels_.resize(width_);
+        litColors_.resize(width_);
+    }
+
+    gBuffer_.resize(width_);
+
+    clearDirtyRegion();
+
+    context_.zBuffer     = zBuffer_;
+    context_.visPolygon  = visPolygon_.data();
+    context_.visTexCoord = visTexCoord_.data();
+    context_.surface     = surface_.data();
+    context_.shadeCache  = shadeCache_.data();
+    context_.samples     = samples_;
 }
 
-ZBufferScanLine::~ZBufferScanLine()
+void ZBufferScanLine::setDirtyRegion(int left, int bottom, int right, int top)
 {
-    reset();
+    // Clamped to the output, it stays empty if left > right or bottom > top
+    partial_      = true;
+    regionLeft_   = std::min(std::max(left, 0), outWidth_ - 1);
+    regionRight_  = std::min(std::max(right, 0), outWidth_ - 1);
+    regionBottom_ = std::min(std::max(bottom, 0), outHeight_ - 1);
+    regionTop_    = std::min(std::max(top, 0), outHeight_ - 1);
+
+    context_.clipLeft  = regionLeft_ * samples_;
+    context_.clipRight = regionRight_ * samples_ + samples_ - 1;
+}
 
-    delete[] zBuffer_;
+void ZBufferScanLine::clearDirtyRegion()
+{
+    partial_      = false;
+    regionLeft_   = 0;
+    regionRight_  = outWidth_ - 1;
+    regionBottom_ = 0;
+    regionTop_    = outHeight_ - 1;
+
+    context_.clipLeft  = 0;
+    context_.clipRight = width_ - 1;
 }
 
-void ZBufferScanLine::reset()
+void ZBufferScanLine::draw(GLubyte* buffer)
 {
-    // Clear active tables
-    activePolygonTable_.clear();
-    activeEdgePairTable_.clear();
+    lightingTime_ = 0.0f;
 
-    // Clear polygons
-    // !! Demo behavior, not considering a second rendering
-    for (auto& polygonTable: polygonTables_)
+    // Bucket the scene by starting line
+    polygonBuckets_.build(height_);
+    pairBuckets_.build(height_);
+    microSpans_.build(height_);
+
+    // A partial redraw writes straight into the previous frame
+    if (!interlace_ || partial_)
     {
-        if (!polygonTable.empty())
+        history_->valid = false;
+        streamOutput_ = true;
+
+        // Scan lines from bottom to up, lines above the region only step the edges
+        for (int row = outHeight_ - 1; row >= regionBottom_; row--)
         {
-            for (ZPolygon* polygon : polygonTable)
+            rasterLine_ = row <= regionTop_;
+            drawRow(row, buffer + row * outWidth_ * 4);
+        }
+
+        rasterLine_ = true;
+
+        // Pairs below the region are never reached
+        for (auto pair : activeEdgePairTable_)
+        {
+            delete pair;
+        }
+
+        activeEdgePairTable_.clear();
+
+        for (int line = 0; line < regionBottom_ * samples_; line++)
+        {
+            for (auto pair = pairBuckets_.begin(line); pair != pairBuckets_.end(line); ++pair)
             {
-                delete polygon;
+                delete *pair;
             }
+        }
 
-            polygonTable.clear();
+#ifdef USE_SSE2
+        _mm_sfence();
+#endif
+
+        return;
+    }
+
+    // Sized at the first interlaced frame, a shared history may come from
+    // a context of another size
+    InterlaceHistory& history = *history_;
+
+    if ((history.width != outWidth_) || (history.height != outHeight_))
+    {
+        for (int i = 0; i < 2; i++)
+        {
+            history.color[i].resize(outWidth_ * outHeight_);
+            history.depth[i].resize(outWidth_ * outHeight_);
         }
+
+        history.width  = outWidth_;
+        history.height = outHeight_;
+        history.valid  = false;
     }
 
-    numPolygon_ = 0;
+    // Draw into the history so missing rows can be rebuilt from the previous frame
+    Pixel* color  = history.color[history.current].data();
+    float* depth  = history.depth[history.current].data();
+    bool   moving = history.valid && (viewProjection_ != history.lastViewProjection);
+
+    interlacedFrame_ = moving;
+    streamOutput_    = false; // The history is read back by the reconstruction and the copy below
+
+    for (int row = outHeight_ - 1; row >= 0; row--)
+    {
+        rasterLine_ = !moving || ((row & 1) == history.field);
+        drawRow(row, reinterpret_cast<GLubyte *>(color + row * outWidth_));
+
+        if (rasterLine_)
+        {
+            saveDepth(depth + row * outWidth_);
+        }
+    }
+
+    rasterLine_ = true;
+
+    if (moving)
+    {
+        reconstructRows();
+        history.field ^= 1;
+    }
+
+    streamCopy(reinterpret_cast<Pixel *>(buffer), color, outWidth_ * outHeight_);
+
+#ifdef USE_SSE2
+    _mm_sfence();
+#endif
+
+    history.lastViewProjection = viewProjection_;
+    history.current           ^= 1;
+    history.valid              = true;
 }
 
-void ZBufferScanLine::draw(GLubyte* buffer)
+void ZBufferScanLine::drawRow(int row, GLubyte* dst)
 {
-    // Scan lines from bottom to up
-    frameBuffer_ = buffer + (height_ - 1) * width_ * 4;
+    if (samples_ == 1)
+    {
+        frameBuffer_ = dst;
+        drawLine(row);
+
+        return;
+    }
 
-    for (int i = height_ - 1; i >= 0; i--)
+    // Each polygon is shaded at most once per pixel in this row
+    if (rasterLine_)
     {
-        drawLine(i);
-        frameBuffer_ -= width_ * 4;
+        for (auto& cache : shadeCache_)
+        {
+            cache.polygon    = nullptr;
+            cache.litPolygon = nullptr;
+        }
+    }
+
+    // Rasterize all sample lines of this row, top first
+    for (int k = samples_ - 1; k >= 0; k--)
+    {
+        frameBuffer_ = sampleBuffer_ + k * width_ * 4;
+        drawLine(row * samples_ + k);
+    }
+
+    if (rasterLine_)
+    {
+        resolveLine(dst);
     }
 }
 
-void ZBufferScanLine::drawLine(int index)
+void ZBufferScanLine::saveDepth(float* dst)
 {
-    std::fill(zBuffer_,            zBuffer_ + width_,            -numeric_limits<float>::max());
-    std::fill((int *)frameBuffer_, (int *)frameBuffer_ + width_, *((int *)bgColor_));
+    std::fill(dst, dst + outWidth_, -numeric_limits<float>::max());
 
-    // Insert new active polygons
-    if (!polygonTables_[index].empty())
+    // Depth of the first sample of each pixel on the last drawn line
+    for (auto& span : coveredSpans_)
     {
-        for (ZPolygon* polygon: polygonTables_[index])
+        for (int x = (span.first + samples_ - 1) / samples_; x * samples_ <= span.second; x++)
         {
-            activePolygonTable_.push_back(polygon);
+            dst[x] = zBuffer_[x * samples_];
         }
     }
+}
+
+void ZBufferScanLine::reconstructRows()
+{
+    InterlaceHistory& history       = *history_;
+    const Pixel     * previousColor = history.color[history.current ^ 1].data();
+    const float     * previousDepth = history.depth[history.current ^ 1].data();
+    Pixel           * color         = history.color[history.current].data();
+    float           * depth         = history.depth[history.current].data();
+    const float       background    = -numeric_limits<float>::max();
+    const float       scaleX        = 1.0f / (outWidth_ - 1);
+    const float       scaleY        = 1.0f / (outHeight_ - 1);
+    const int         drawnParity   = 1 - history.field; // Of the previous frame, the rows missing now
+
+    // World position from screen x, y and w: solve the x, y and w rows of
+    // the view projection. Projected with the previous camera, a pixel at
+    // screen x, y lands on w * (K * (x, y, 1)) + c
+    const glm::mat4& vp        = viewProjection_;
+    const glm::mat4& last      = history.lastViewProjection;
+    glm::mat3        unproject = glm::inverse(glm::mat3(glm::vec3(vp[0][0], vp[0][1], vp[0][3]),
+                                                        glm::vec3(vp[1][0], vp[1][1], vp[1][3]),
+                                                        glm::vec3(vp[2][0], vp[2][1], vp[2][3])));
+    glm::vec3 offset = glm::vec3(vp[3][0], vp[3][1], vp[3][3]);
+    glm::vec4 k[3];
+
+    for (int i = 0; i < 3; i++)
+    {
+        k[i] = last[0] * unproject[i].x + last[1] * unproject[i].y + last[2] * unproject[i].z;
+    }
+
+    glm::vec4 c     = last[3] - (k[0] * offset.x + k[1] * offset.y + k[2] * offset.z);
+    glm::vec4 stepX = k[0] * scaleX;
+
+    // Rows are independent, the missing field is rebuilt in bands
+    int first = 1 - history.field;
+    int rows  = (outHeight_ - first + 1) / 2;
+
+    auto rebuildBand = [&](int begin, int end) {
+                       for (int band = begin; band < end; band++)
+                       {
+                           int row   = first + band * 2;
+                           int below = row > 0 ? row - 1 : row + 1;
+                           int above = row < outHeight_ - 1 ? row + 1 : row - 1;
+
+                           const Pixel* colorBelow = color + below * outWidth_;
+                           const Pixel* colorAbove = color + above * outWidth_;
+                           const float* depthBelow = depth + below * outWidth_;
+                           const float* depthAbove = depth + above * outWidth_;
+                           Pixel      * dstColor   = color + row * outWidth_;
+                           float      * dstDepth   = depth + row * outWidth_;
+                           glm::vec4    ray        = k[2] - k[0] * 0.5f + k[1] * (row * scaleY - 0.5f);
+
+                           for (int x = 0; x < outWidth_; x++, ray += stepX)
+                           {
+                               // Nearer of the two drawn neighbours
+                               float z = std::max(depthBelow[x], depthAbove[x]);
+
+                               dstColor[x] = lerpPixel(colorBelow[x], colorAbove[x], 128);
+                               dstDepth[x] = z;
+
+                               if (z == background)
+                               {
+                                   continue;
+                               }
+
+                               glm::vec4 previous = ray * (1.0f / z) + c;
+
+                               if (previous.w <= 0)
+                               {
+                                   continue;
+                               }
+
+                               // Only rows drawn by the previous frame, the others were rebuilt
+                               // themselves and errors would pile up
+                               float invW  = 1.0f / previous.w;
+                               int   lastX = static_cast<int>((previous.x * invW + 0.5f) * (outWidth_ - 1) + 0.5f);
+                               int   lastY = static_cast<int>(floor(((previous.y * invW + 0.5f) * (outHeight_ - 1) - drawnParity) * 0.5f + 0.5f))
+                                             * 2 + drawnParity;
+
+                               if ((lastX < 0) || (lastX >= outWidth_) || (lastY < 0) || (lastY >= outHeight_))
+                               {
+                                   continue;
+                               }
+
+                               // Keep the history only where it saw the same surface
+                               float lastZ = previousDepth[lastX + lastY * outWidth_];
+
+                               if (fabs(lastZ * previous.w - 1.0f) < HISTORY_DEPTH_TOLERANCE)
+                               {
+                                   dstColor[x] = previousColor[lastX + lastY * outWidth_];
+                               }
+                           }
+                       }
+                       };
+
+    TaskScheduler::shared().parallelFor(0, rows, RECONSTRUCT_BAND, rebuildBand);
+}
+
+void ZBufferScanLine::resolveLine(GLubyte* dst)
+{
+    const int count   = samples_ * samples_;
+    Pixel   * samples = reinterpret_cast<Pixel *>(sampleBuffer_);
+
+    for (int x = regionLeft_; x <= regionRight_; x++)
+    {
+        PixelSum sum;
+
+        // Box filter over the samples of this pixel
+        for (int k = 0; k < samples_; k++)
+        {
+            const Pixel* sample = samples + k * width_ + x * samples_;
+
+            for (int j = 0; j < samples_; j++)
+            {
+                sum.add(sample[j]);
+            }
+        }
+
+        // In place: pixel x only overwrites samples of pixels already resolved
+        samples[x] = sum.average(count) | PIXEL_OPAQUE;
+    }
+
+    if (streamOutput_)
+    {
+        streamCopy(reinterpret_cast<Pixel *>(dst) + regionLeft_, samples + regionLeft_, regionRight_ - regionLeft_ + 1);
+    }
+    else
+    {
+        std::copy(samples + regionLeft_, samples + regionRight_ + 1, reinterpret_cast<Pixel *>(dst) + regionLeft_);
+    }
+}
+
+void ZBufferScanLine::drawLine(int index)
+{
+    // Insert new active polygons
+    if (!polygonBuckets_.empty(index))
+    {
+        activePolygonTable_.insert(activePolygonTable_.end(), polygonBuckets_.begin(index), polygonBuckets_.end(index));
+    }
+
+    // Pairs carried over from the previous line come first
+    int carried = static_cast<int>(activeEdgePairTable_.size());
 
     for (ZPolygon* polygon: activePolygonTable_)
     {
@@ -219,12 +555,77 @@ void ZBufferScanLine::drawLine(int index)
         insertActiveEdgePairs(index, *polygon);
     }
 
+    // Triangle pairs starting on this line are ready to draw
+    if (!pairBuckets_.empty(index))
+    {
+        activeEdgePairTable_.insert(activeEdgePairTable_.end(), pairBuckets_.begin(index), pairBuckets_.end(index));
+    }
+
+    sortActiveEdgePairs(carried);
+
+    // Lines skipped by interlacing only step the edges
+    if (rasterLine_)
+    {
+        // Only the covered part of the line needs clearing, gaps get the background at the end
+        collectSpans(index);
+
+        context_.frameBuffer = reinterpret_cast<Pixel *>(frameBuffer_);
+
+        for (auto& span : coveredSpans_)
+        {
+            std::fill(zBuffer_ + span.first, zBuffer_ + span.second + 1, -numeric_limits<float>::max());
+
+            if (visibilityBuffer_)
+            {
+                std::fill(visPolygon_.begin() + span.first, visPolygon_.begin() + span.second + 1, nullptr);
+            }
+
+            if (lighting_)
+            {
+                std::fill(surface_.begin() + span.first, surface_.begin() + span.second + 1, nullptr);
+            }
+        }
+    }
+
     // Draw all edge pairs
     for (auto pair: activeEdgePairTable_)
     {
-        drawEdgePair(*pair);
+        if (pair->triangle)
+        {
+            drawEdgePair<true>(*pair);
+        }
+        else
+        {
+            drawEdgePair<false>(*pair);
+        }
     }
 
+    if (rasterLine_)
+    {
+        // Lines of small triangles were stepped at insertion
+        for (auto span = microSpans_.begin(index); span != microSpans_.end(index); ++span)
+        {
+            microPair_.polygon = span->polygon;
+            microPair_.z_l     = span->z_l;
+            microPair_.dz_x    = span->dz_x;
+            microPair_.t_l     = span->t_l;
+            microPair_.t_r     = span->t_r;
+            span->polygon->kernel(context_, microPair_, span->start_x, span->end_x);
+        }
+
+        // Texture only the surviving fragments
+        if (visibilityBuffer_)
+        {
+            shadeLine();
+        }
+
+        if (lighting_)
+        {
+            lightLine(index);
+        }
+
+        fillGaps();
+    }
     for (auto polygon: activePolygonTable_)
     {
         polygon->dy--;
@@ -233,7 +634,8 @@ void ZBufferScanLine::drawLine(int index)
     // Remove finished pairs
     auto checkEdgePair = [](ActiveEdgePair* edgePair)
                          {
-                             if ((edgePair->leftEdge->dy <= 0) && (edgePair->rightEdge->dy <= 0))
+                             if (edgePair->triangle ? (edgePair->dy <= 0) :
+                                 ((edgePair->leftEdge->dy <= 0) && (edgePair->rightEdge->dy <= 0)))
                              {
                                  delete edgePair;
                                  return true;
@@ -251,6 +653,139 @@ void ZBufferScanLine::drawLine(int index)
                               activePolygonTable_.end());
 }
 
+void ZBufferScanLine::sortActiveEdgePairs(int carried)
+{
+    auto leftOf = [](const ActiveEdgePair* a, const ActiveEdgePair* b) {
+                      return a->leftEdge->x < b->leftEdge->x;
+                  };
+
+    // Spans keep their order from line to line except where they cross,
+    // so insertion sort of the carried pairs is nearly linear
+    for (int i = 1; i < carried; i++)
+    {
+        ActiveEdgePair* pair = activeEdgePairTable_[i];
+        int             j    = i - 1;
+
+        while ((j >= 0) && leftOf(pair, activeEdgePairTable_[j]))
+        {
+            activeEdgePairTable_[j + 1] = activeEdgePairTable_[j];
+            j--;
+        }
+
+        activeEdgePairTable_[j + 1] = pair;
+    }
+
+    // New pairs are sorted on their own and merged in
+    if (static_cast<size_t>(carried) < activeEdgePairTable_.size())
+    {
+        std::sort(activeEdgePairTable_.begin() + carried, activeEdgePairTable_.end(), leftOf);
+
+        mergedPairs_.resize(activeEdgePairTable_.size());
+        std::merge(activeEdgePairTable_.begin(), activeEdgePairTable_.begin() + carried,
+                   activeEdgePairTable_.begin() + carried, activeEdgePairTable_.end(),
+                   mergedPairs_.begin(), leftOf);
+        activeEdgePairTable_.swap(mergedPairs_);
+    }
+}
+
+void ZBufferScanLine::collectSpans(int index)
+{
+    coveredSpans_.clear();
+
+    for (auto pair : activeEdgePairTable_)
+    {
+        // Same range as drawEdgePair
+        int start_x = static_cast<int>(pair->leftEdge->x);
+        int end_x   = static_cast<int>(pair->leftEdge == pair->rightEdge ? pair->leftEdge->dx : pair->rightEdge->x);
+
+        if ((start_x < 0) || (end_x < 0))
+        {
+            continue;
+        }
+
+        // Only the clip range is drawn
+        start_x = std::max(start_x, context_.clipLeft);
+        end_x   = std::min(end_x, context_.clipRight);
+
+        if (start_x > end_x)
+        {
+            continue;
+        }
+
+        coveredSpans_.emplace_back(start_x, end_x);
+    }
+
+    // Already ordered by start, the active table is sorted by left x
+    int sorted = static_cast<int>(coveredSpans_.size());
+
+    for (auto span = microSpans_.begin(index); span != microSpans_.end(index); ++span)
+    {
+        int start_x = std::max(span->start_x, context_.clipLeft);
+        int end_x   = std::min(span->end_x, context_.clipRight);
+
+        if (start_x <= end_x)
+        {
+            coveredSpans_.emplace_back(start_x, end_x);
+        }
+    }
+
+    // Micro spans are in insertion order
+    if (static_cast<size_t>(sorted) < coveredSpans_.size())
+    {
+        std::sort(coveredSpans_.begin() + sorted, coveredSpans_.end());
+        std::inplace_merge(coveredSpans_.begin(), coveredSpans_.begin() + sorted, coveredSpans_.end());
+    }
+
+    // Merge overlapping and touching spans
+    int merged = 0;
+
+    for (size_t i = 1; i < coveredSpans_.size(); i++)
+    {
+        if (coveredSpans_[i].first <= coveredSpans_[merged].second + 1)
+        {
+            coveredSpans_[merged].second = std::max(coveredSpans_[merged].second, coveredSpans_[i].second);
+        }
+        else
+        {
+            coveredSpans_[++merged] = coveredSpans_[i];
+        }
+    }
+
+    if (!coveredSpans_.empty())
+    {
+        coveredSpans_.resize(merged + 1);
+    }
+}
+
+void ZBufferScanLine::fillGaps()
+{
+    Pixel* line = reinterpret_cast<Pixel *>(frameBuffer_);
+    int    x    = context_.clipLeft;
+
+    for (auto& span : coveredSpans_)
+    {
+        fillBackground(line + x, span.first - x);
+        x = span.second + 1;
+    }
+
+    fillBackground(line + x, context_.clipRight + 1 - x);
+}
+
+void ZBufferScanLine::fillBackground(Pixel* dst, int count)
+{
+    // Sample lines are read back by the resolve and history lines by the
+    // interlacing, output lines are not
+    if ((samples_ == 1) && streamOutput_)
+    {
+        streamFill(dst, count, bgColor_);
+    }
+    else
+    {
+        std::fill(dst, dst + count, bgColor_);
+    }
+}
+
+template<bool TRIANGLE>
 void ZBufferScanLine::drawEdgePair(ActiveEdgePair& edgePair)
 {
     auto& left  = edgePair.leftEdge;
@@ -267,43 +802,10 @@ void ZBufferScanLine::drawEdgePair(ActiveEdgePair& edgePair)
         return;
     }
 
-    // Depth interpolation
-    float z_l = edgePair.z_l;
-    float z_x = z_l;
-    float z_r = z_x + edgePair.dz_x * (end_x - start_x + 1);
-
-    // Texture interpolation
-    glm::vec2 t_l  = edgePair.t_l;
-    glm::vec2 t_x  = t_l;
-    glm::vec2 t_r  = edgePair.t_r;
-    glm::vec2 dtex = (t_r * z_r - t_l * z_l) / static_cast<float>(end_x - start_x + 1);
-
-    // Scan along edge pair
-    for (int x = start_x; x <= end_x; x++)
+    // Branch-free loop specialized for this polygon
+    if (rasterLine_)
     {
-        // Determine color
-        if (z_x > zBuffer_[x])
-        {
-            zBuffer_[x] = z_x;
-
-            if (edgePair.polygon->textures != nullptr)
-            {
-                sampleTexture2D(t_x, edgePair.polygon->textures, frameBuffer_ + x * 4);
-            }
-            else
-            {
-                colorCpy(frameBuffer_ + x * 4, edgePair.polygon->color);
-            }
-        }
-
-        // Step interpolation
-        float z_x_o = z_x;
-        z_x += edgePair.dz_x;
-
-        if (edgePair.polygon->textures != nullptr)
-        {
-            t_x = (t_x * z_x_o + dtex) / z_x;
-        }
+        edgePair.polygon->kernel(context_, edgePair, start_x, end_x);
     }
 
     // Update pair status
@@ -317,11 +819,21 @@ void ZBufferScanLine::drawEdgePair(ActiveEdgePair& edgePair)
     edgePair.t_l = (edgePair.t_l * z_l_o + left->dtex) / edgePair.z_l;
     edgePair.t_r = (edgePair.t_r * z_r_o + right->dtex) / edgePair.z_r;
 
+    if (TRIANGLE)
+    {
+        // Both edges last as long as the pair
+        left->x  += left->dx;
+        right->x += right->dx;
+        edgePair.dy--;
+
+        return;
+    }
+
     // Update edge status (stall and wait when dy reaching zero)
     if (left->dy > 0)
     {
         left->dy--;
-        left->x += left->dx;
+        left->x  += left->dx;
     }
 
     if (right->dy > 0)
@@ -357,32 +869,176 @@ void ZBufferScanLine::drawEdgePair(ActiveEdgePair& edgePair)
                 break;
             }
         }
-    }
+    }
+
+    // If right finishes
+    if ((right->dy <= 0) && (left->dy >= 0))
+    {
+        // Pick one line from the unpaired lines
+        auto& unPaired = edgePair.polygon->unpairedEdges;
+
+        for (auto itr = unPaired.begin(); itr != unPaired.end(); ++itr)
+        {
+            if (abs((*itr)->x - right->x) < SAME_PIXEL_LIMIT)
+            {
+                right        = *(itr);
+                edgePair.z_r = right->z;
+
+                // Roll back one line for the rest line
+                left->dy++;
+                left->x     -= left->dx;
+                edgePair.z_l = z_l_o;
+                edgePair.t_l = t_l_o;
+
+                unPaired.erase(itr);
+                break;
+            }
+        }
+    }
+}
+
+void ZBufferScanLine::shadeLine()
+{
+    // Runs of one polygon are sampled together, see TexelSampler
+    for (auto& span : coveredSpans_)
+    {
+        int x = span.first;
+
+        while (x <= span.second)
+        {
+            ZPolygon* polygon = visPolygon_[x];
+            int       last    = x + 1;
+
+            while ((last <= span.second) && (visPolygon_[last] == polygon))
+            {
+                last++;
+            }
+
+            if (polygon != nullptr)
+            {
+                shadeRun(polygon, x, last);
+            }
+
+            x = last;
+        }
+    }
+}
+
+void ZBufferScanLine::shadeRun(ZPolygon* polygon, int first, int last)
+{
+    Pixel* colors = reinterpret_cast<Pixel *>(frameBuffer_);
+
+    if (samples_ == 1)
+    {
+        polygon->sampler(*polygon, visTexCoord_.data() + first, last - first, colors + first);
+        return;
+    }
+
+    // Shade once per pixel: sample the pixels the polygon has not shaded yet,
+    // then copy to every covered sample
+    runPixels_.clear();
+    runTexCoords_.clear();
+
+    for (int x = first; x < last; x++)
+    {
+        ShadeCache& cache = shadeCache_[x / samples_];
+
+        if (cache.polygon != polygon)
+        {
+            cache.polygon = polygon;
+            runPixels_.push_back(x / samples_);
+            runTexCoords_.push_back(visTexCoord_[x]);
+        }
+    }
+
+    runColors_.resize(runPixels_.size());
+    polygon->sampler(*polygon, runTexCoords_.data(), static_cast<int>(runPixels_.size()), runColors_.data());
+
+    for (size_t i = 0; i < runPixels_.size(); i++)
+    {
+        shadeCache_[runPixels_[i]].color = runColors_[i];
+    }
+
+    for (int x = first; x < last; x++)
+    {
+        colors[x] = shadeCache_[x / samples_].color;
+    }
+}
+
+void ZBufferScanLine::lightLine(int index)
+{
+    auto   start  = chrono::steady_clock::now();
+    float  y      = static_cast<float>(index);
+    Pixel* colors = reinterpret_cast<Pixel *>(frameBuffer_);
+
+    // G-buffer entry i from the surface at x, attributes are perspective corrected through 1 / w
+    auto fillSurface = [this, y](int i, int x, const ZPolygon* polygon) {
+                           glm::vec3 pixel = glm::vec3(x, y, 1.0f) / zBuffer_[x];
+
+                           gBuffer_.normalX[i]   = glm::dot(polygon->normalPlanes[0], pixel);
+                           gBuffer_.normalY[i]   = glm::dot(polygon->normalPlanes[1], pixel);
+                           gBuffer_.normalZ[i]   = glm::dot(polygon->normalPlanes[2], pixel);
+                           gBuffer_.positionX[i] = glm::dot(polygon->positionPlanes[0], pixel);
+                           gBuffer_.positionY[i] = glm::dot(polygon->positionPlanes[1], pixel);
+                           gBuffer_.positionZ[i] = glm::dot(polygon->positionPlanes[2], pixel);
+                           gBuffer_.covered[i]   = ~0u;
+                       };
+
+    for (auto& span : coveredSpans_)
+    {
+        if (samples_ == 1)
+        {
+            for (int x = span.first; x <= span.second; x++)
+            {
+                if (surface_[x] != nullptr)
+                {
+                    fillSurface(x, x, surface_[x]);
+                }
+                else
+                {
+                    gBuffer_.covered[x] = 0;
+                }
+            }
+
+            lightingPass_.shadeLine(frameBuffer_, gBuffer_, span.first, span.second + 1);
+            continue;
+        }
+
+        // Multisampling: light once per pixel and polygon like the texture
+        // shading, the first sample of each goes into a packed G-buffer
+        int count = 0;
+
+        for (int x = span.first; x <= span.second; x++)
+        {
+            ZPolygon  * polygon = surface_[x];
+            ShadeCache& cache   = shadeCache_[x / samples_];
+
+            if ((polygon != nullptr) && (cache.litPolygon != polygon))
+            {
+                cache.litPolygon  = polygon;
+                litPixels_[count] = x / samples_;
+                litColors_[count] = colors[x];
+                fillSurface(count++, x, polygon);
+            }
+        }
 
-    // If right finishes
-    if ((right->dy <= 0) && (left->dy >= 0))
-    {
-        // Pick one line from the unpaired lines
-        auto& unPaired = edgePair.polygon->unpairedEdges;
+        lightingPass_.shadeLine(reinterpret_cast<GLubyte *>(litColors_.data()), gBuffer_, 0, count);
 
-        for (auto itr = unPaired.begin(); itr != unPaired.end(); ++itr)
+        for (int i = 0; i < count; i++)
         {
-            if (abs((*itr)->x - right->x) < SAME_PIXEL_LIMIT)
-            {
-                right        = *(itr);
-                edgePair.z_r = right->z;
-
-                // Roll back one line for the rest line
-                left->dy++;
-                left->x     -= left->dx;
-                edgePair.z_l = z_l_o;
-                edgePair.t_l = t_l_o;
+            shadeCache_[litPixels_[i]].litColor = litColors_[i];
+        }
 
-                unPaired.erase(itr);
-                break;
+        for (int x = span.first; x <= span.second; x++)
+        {
+            if (surface_[x] != nullptr)
+            {
+                colors[x] = shadeCache_[x / samples_].litColor;
             }
         }
     }
+
+    lightingTime_ += chrono::duration<float, milli>(chrono::steady_clock::now() - start).count();
 }
 
 void ZBufferScanLine::insertActiveEdgePairs(int lineIndex, ZPolygon& polygon)
@@ -429,6 +1085,24 @@ ZEdge * ZBufferScanLine::generateEdge(glm::vec3* p1,
     // Generate an edge
     ZEdge* zEdge = new ZEdge;
 
+    if (!initEdge(*zEdge, p1, p2, top, bottom, useTexture, tex1, tex2))
+    {
+        delete zEdge;
+        return nullptr;
+    }
+
+    return zEdge;
+}
+
+bool ZBufferScanLine::initEdge(ZEdge    & zEdge,
+                               glm::vec3* p1,
+                               glm::vec3* p2,
+                               int      & top,
+                               int      & bottom,
+                               bool       useTexture,
+                               glm::vec2  tex1,
+                               glm::vec2  tex2)
+{
     // Make sure p1 is the upper point
     if (p1->y < p2->y)
     {
@@ -440,13 +1114,13 @@ ZEdge * ZBufferScanLine::generateEdge(glm::vec3* p1,
     if ((p1->y < 0) || (p1->y > height_) || (p1->x < 0) || (p1->y > height_))
     {
         cout << "Bad edge" << endl;
-        return nullptr;
+        return false;
     }
 
     if ((p2->y < 0) || (p2->y > height_) || (p2->x < 0) || (p2->y > height_))
     {
         cout << "Bad edge" << endl;
-        return nullptr;
+        return false;
     }
 
     // Range keeping
@@ -464,28 +1138,28 @@ ZEdge * ZBufferScanLine::generateEdge(glm::vec3* p1,
     }
 
     // Insert edge
-    zEdge->y  = static_cast<int>(p1->y);
-    zEdge->x  = p1->x;
-    zEdge->z  = p1->z;
-    zEdge->dy = edgeTop - edgeBottom + 1;
+    zEdge.y  = static_cast<int>(p1->y);
+    zEdge.x  = p1->x;
+    zEdge.z  = p1->z;
+    zEdge.dy = edgeTop - edgeBottom + 1;
 
     if (useTexture)
     {
-        zEdge->texCoord = tex1;
-        zEdge->dtex     = (tex2 * p2->z - tex1 * p1->z) / static_cast<float>(zEdge->dy);
+        zEdge.texCoord = tex1;
+        zEdge.dtex     = (tex2 * p2->z - tex1 * p1->z) / static_cast<float>(zEdge.dy);
     }
 
-    if (zEdge->dy != 1)
+    if (zEdge.dy != 1)
     {
-        zEdge->dx = -(p1->x - p2->x) / zEdge->dy;
+        zEdge.dx = -(p1->x - p2->x) / zEdge.dy;
     }
     else
     {
         // Horizontal edge: label the ending x
-        zEdge->dx = p2->x;
+        zEdge.dx = p2->x;
     }
 
-    return zEdge;
+    return true;
 }
 
 ActiveEdgePair * ZBufferScanLine::generateEdgePair(ZEdge* left, ZEdge* right, ZPolygon& polygon)
@@ -521,14 +1195,291 @@ ActiveEdgePair * ZBufferScanLine::generateEdgePair(ZEdge* left, ZEdge* right, ZP
     return pair;
 }
 
+void ZBufferScanLine::setupTriangle(ZPolygon               & polygon,
+                                    const glm::vec3        * projected,
+                                    const glm::ivec2       & rows,
+                                    const vector<glm::vec2>& texCoords,
+                                    bool                     useTexture)
+{
+    // Sort the vertices from top to bottom
+    int order[3] = { 0, 1, 2 };
+
+    for (int pass = 0; pass < 2; pass++)
+    {
+        for (int i = 0; i < 2 - pass; i++)
+        {
+            if (projected[order[i]].y < projected[order[i + 1]].y)
+            {
+                SWAP(order[i], order[i + 1]);
+            }
+        }
+    }
+
+    glm::vec3 p[3];
+    glm::vec2 tex[3];
+
+    for (int i = 0; i < 3; i++)
+    {
+        p[i] = projected[order[i]];
+
+        if (useTexture)
+        {
+            tex[i] = texCoords[order[i]];
+        }
+    }
+
+    int yTop = rows.x;
+    int yMid = static_cast<int>(p[1].y);
+    int yBot = rows.y;
+
+    // Triangles of a few lines are stepped right away into micro spans, their
+    // edges and pairs only live on the stack
+    bool           small = yTop - yBot < SMALL_TRIANGLE_LINES;
+    ZEdge          smallEdges[3];
+    ActiveEdgePair smallPairs[2];
+    int            smallLines[2];
+    int            smallCount = 0;
+
+    auto newEdge = [&](int i) {
+                       ZEdge* edge = small ? &smallEdges[i] : new ZEdge;
+
+                       if (!small)
+                       {
+                           polygon.edges.push_back(edge);
+                       }
+                       return edge;
+                   };
+
+    auto addPair = [&](ZEdge* left, ZEdge* right, int line, int lines) {
+                       if (small)
+                       {
+                           initTrianglePair(smallPairs[smallCount], left, right, polygon, line, lines);
+                           smallLines[smallCount++] = line;
+                       }
+                       else
+                       {
+                           pairBuckets_.add(line, generateTrianglePair(left, right, polygon, line, lines));
+                       }
+                   };
+
+    // Edges are generated like the generic path's, so shared edges step identically
+    int    top      = -1;
+    int    bottom   = height_;
+    ZEdge* longEdge = newEdge(0);
+    initEdge(*longEdge, &p[0], &p[2], top, bottom, useTexture, tex[0], tex[2]);
+
+    // Is the middle vertex left of the long edge?
+    float longX   = p[0].x + (p[2].x - p[0].x) * (p[1].y - p[0].y) / (p[2].y - p[0].y);
+    bool  midLeft = p[1].x < longX;
+
+    // The upper pair covers the lines down to and including the middle vertex
+    if (yTop > yMid)
+    {
+        ZEdge* upper = newEdge(1);
+        initEdge(*upper, &p[0], &p[1], top, bottom, useTexture, tex[0], tex[1]);
+
+        ZEdge* left  = midLeft ? upper : longEdge;
+        ZEdge* right = midLeft ? longEdge : upper;
+        addPair(left, right, yTop, yTop - yMid + 1);
+    }
+
+    // The lower pair continues with the long edge where the upper pair left it
+    if (yMid > yBot)
+    {
+        ZEdge* lower = newEdge(2);
+        initEdge(*lower, &p[1], &p[2], top, bottom, useTexture, tex[1], tex[2]);
+
+        int    start = yTop > yMid ? yMid - 1 : yMid;
+        ZEdge* left  = midLeft ? lower : longEdge;
+        ZEdge* right = midLeft ? longEdge : lower;
+        addPair(left, right, start, start - yBot + 1);
+
+        if (start != yMid)
+        {
+            // Skip the middle line, which the upper pair draws
+            lower->x += lower->dx;
+        }
+    }
+
+    polygon.dy = top - bottom + 1;
+
+    // Upper pair first, it leaves the long edge where the lower pair starts
+    for (int i = 0; i < smallCount; i++)
+    {
+        addMicroSpans(smallPairs[i], smallLines[i]);
+    }
+}
+
+ActiveEdgePair * ZBufferScanLine::generateTrianglePair(ZEdge* left, ZEdge* right, ZPolygon& polygon, int line,
+                                                       int lines)
+{
+    ActiveEdgePair* pair = new ActiveEdgePair;
+
+    initTrianglePair(*pair, left, right, polygon, line, lines);
+
+    return pair;
+}
+
+void ZBufferScanLine::initTrianglePair(ActiveEdgePair& pair, ZEdge* left, ZEdge* right, ZPolygon& polygon, int line,
+                                       int lines)
+{
+    pair.leftEdge  = left;
+    pair.rightEdge = right;
+    pair.triangle  = true;
+    pair.dy        = lines;
+    pair.polygon   = &polygon;
+
+    // Edges may start above this line
+    int   stepsLeft  = left->y - line;
+    int   stepsRight = right->y - line;
+    float x_l        = left->x + left->dx * stepsLeft;
+    float x_r        = right->x + right->dx * stepsRight;
+
+    // depth interpolation
+    glm::vec4& depthPlane = polygon.depthPlane;
+    pair.z_l  = stepsLeft == 0 ? left->z : computeZ(depthPlane, x_l, static_cast<float>(line));
+    pair.z_r  = stepsRight == 0 ? right->z : computeZ(depthPlane, x_r, static_cast<float>(line));
+    pair.dz_x = depthPlane.z < FLT_EPS ? 0 : -depthPlane.x / depthPlane.z;
+    pair.dz_y = depthPlane.z < FLT_EPS ? 0 : depthPlane.y / depthPlane.z;
+
+    // texture interpolation (texture * z is linear along the edge)
+    if (polygon.textures != nullptr)
+    {
+        pair.t_l = (left->texCoord * left->z + left->dtex * static_cast<float>(stepsLeft)) / pair.z_l;
+        pair.t_r = (right->texCoord * right->z + right->dtex * static_cast<float>(stepsRight)) / pair.z_r;
+    }
+}
+
+ZPolygon * ZBufferScanLine::acquireTriangle()
+{
+    if (usedTriangles_ == static_cast<int>(trianglePool_.size()))
+    {
+        trianglePool_.push_back(new ZPolygon);
+    }
+
+    return trianglePool_[usedTriangles_++];
+}
+
+void ZBufferScanLine::recycleTriangle(ZPolygon& polygon)
+{
+    for (ZEdge* edge : polygon.edges)
+    {
+        delete edge;
+    }
+
+    polygon.edges.clear();
+    polygon.unpairedEdges.clear();
+    polygon.textures = nullptr;
+}
+
+void ZBufferScanLine::addMicroSpans(ActiveEdgePair& pair, int line)
+{
+    ZEdge* left     = pair.leftEdge;
+    ZEdge* right    = pair.rightEdge;
+    bool   textured = pair.polygon->textures != nullptr;
+
+    // Same ranges and stepping as drawEdgePair<true>
+    for ( ; pair.dy > 0; pair.dy--, line--)
+    {
+        MicroSpan span;
+        span.polygon = pair.polygon;
+        span.start_x = static_cast<int>(left->x);
+        span.end_x   = static_cast<int>(right->x);
+        span.z_l     = pair.z_l;
+        span.dz_x    = pair.dz_x;
+        span.t_l     = pair.t_l;
+        span.t_r     = pair.t_r;
+
+        if ((span.start_x >= 0) && (span.end_x >= 0))
+        {
+            microSpans_.add(line, span);
+        }
+
+        float z_l_o = pair.z_l;
+        float z_r_o = pair.z_r;
+        pair.z_l += pair.dz_x * left->dx + pair.dz_y;
+        pair.z_r += pair.dz_x * right->dx + pair.dz_y;
+
+        if (textured)
+        {
+            pair.t_l = (pair.t_l * z_l_o + left->dtex) / pair.z_l;
+            pair.t_r = (pair.t_r * z_r_o + right->dtex) / pair.z_r;
+        }
+
+        left->x  += left->dx;
+        right->x += right->dx;
+    }
+}
+
+void ZBufferScanLine::selectKernel(ZPolygon& polygon)
+{
+    bool textured = (polygon.textures != nullptr) && !polygon.textures->empty();
+    int  filter   = bilinearFilter_ ? SPAN_BILINEAR : SPAN_NEAREST;
+    int  shade;
+
+    if (textured && (polygon.textures->size() > 1))
+    {
+        filter += SPAN_NEAREST_LAYERED;
+    }
+
+    if (!textured)
+    {
+        shade = visibilityBuffer_ ? SPAN_FLAT_DEFERRED : SPAN_FLAT;
+    }
+    else if (visibilityBuffer_)
+    {
+        shade = SPAN_TEXTURE_DEFERRED;
+    }
+    else
+    {
+        shade = (samples_ > 1 ? SPAN_TEXTURE_CACHED : SPAN_TEXTURE) + filter;
+    }
+
+    polygon.kernel  = SPAN_KERNELS[shade][lighting_];
+    polygon.sampler = textured ? TEXEL_SAMPLERS[filter] : nullptr;
+}
+
+bool ZBufferScanLine::outsideRegion(const glm::vec3* projected, int count)
+{
+    float left   = numeric_limits<float>::max();
+    float right  = -left;
+    float bottom = left;
+    float top    = right;
+
+    for (int i = 0; i < count; i++)
+    {
+        const glm::vec3& point = projected[i];
+
+        // Bounds are meaningless with a vertex behind the camera
+        if (point.z <= 0)
+        {
+            return false;
+        }
+
+        left   = std::min(left, point.x);
+        right  = std::max(right, point.x);
+        bottom = std::min(bottom, point.y);
+        top    = std::max(top, point.y);
+    }
+
+    return (right < context_.clipLeft) || (left > context_.clipRight + 1)
+           || (top < regionBottom_ * samples_) || (bottom > (regionTop_ + 1) * samples_);
+}
+
 void ZBufferScanLine::insertPolygon(Geometry::Face* face, GeometryResource* geometry, bool useTexture)
 {
+    // About half of a closed mesh never gets projected
+    if (isBackFace(face))
+    {
+        return;
+    }
+
     // Save points in screen space
     vector<glm::vec3> projected;
 
     projected.reserve(face->indices.size());
 
-    for (int i = 0; i < face->indices.size(); i++)
+    for (size_t i = 0; i < face->indices.size(); i++)
     {
         glm::vec4 projectedPoint = mvp_ * glm::vec4(face->vertices[face->indices[i]]->position, 1.0f);
         projectedPoint.x = (projectedPoint.x / projectedPoint.w + 0.5f) * (width_ - 1);
@@ -538,23 +1489,256 @@ void ZBufferScanLine::insertPolygon(Geometry::Face* face, GeometryResource* geom
         projected.push_back(projectedPoint);
     }
 
-    // Save texture coordinates
-    vector<glm::vec2> windowTexCoord;
+    // Polygons off the dirty region leave it unchanged
+    if (partial_ && outsideRegion(projected.data(), projected.size()))
+    {
+        return;
+    }
+
+    insertProjected(face, geometry, useTexture, projected.data(), projected.size());
+}
 
-    if (useTexture)
+void ZBufferScanLine::insertPolygons(GeometryResource* geometry, bool useTexture)
+{
+    Geometry::Face* batch[TRIANGLE_BATCH];
+    int             count = 0;
+
+    for (auto face : geometry->faces)
+    {
+        // Other polygons keep their place in the insertion order
+        if (face->indices.size() != 3)
+        {
+            setupTriangleBatch(batch, count, geometry, useTexture);
+            count = 0;
+
+            insertPolygon(face, geometry, useTexture);
+            continue;
+        }
+
+        // Only front faces join the batch, see isBackFace
+        if (glm::dot(face->plane, eye_) < 0)
+        {
+            batch[count++] = face;
+
+            if (count == TRIANGLE_BATCH)
+            {
+                setupTriangleBatch(batch, count, geometry, useTexture);
+                count = 0;
+            }
+        }
+    }
+
+    setupTriangleBatch(batch, count, geometry, useTexture);
+}
+
+void ZBufferScanLine::setupTriangleBatch(Geometry::Face** faces, int count, GeometryResource* geometry, bool useTexture)
+{
+    glm::vec3  points[TRIANGLE_BATCH][3];
+    glm::ivec2 rows[TRIANGLE_BATCH]; // Top and bottom line of the triangles inside the window
+    int        keep   = 0;           // Bit per triangle that goes on to setup
+    int        inside = 0;           // Bit per triangle inside the window
+    int        i      = 0;
+
+    // Same arithmetic as insertPolygon, so both give the same points
+    const glm::mat4& m      = mvp_;
+    const float      scaleX = static_cast<float>(width_ - 1);
+    const float      scaleY = static_cast<float>(height_ - 1);
+
+    // Triangles in front of the camera past one of these edges draw nothing,
+    // the window's or the dirty region's
+    float boundLeft   = 0;
+    float boundRight  = scaleX;
+    float boundBottom = 0;
+    float boundTop    = scaleY;
+
+    if (partial_)
+    {
+        boundLeft   = std::max(boundLeft, static_cast<float>(context_.clipLeft));
+        boundRight  = std::min(boundRight, static_cast<float>(context_.clipRight + 1));
+        boundBottom = std::max(boundBottom, static_cast<float>(regionBottom_ * samples_));
+        boundTop    = std::min(boundTop, static_cast<float>((regionTop_ + 1) * samples_));
+    }
+
+#ifdef USE_SSE2
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 one  = _mm_set1_ps(1.0f);
+    const __m128 half = _mm_set1_ps(0.5f);
+    const __m128 maxX = _mm_set1_ps(scaleX);
+    const __m128 maxY = _mm_set1_ps(scaleY);
+
+    // Four triangles per iteration, one lane each
+    for (; i + 4 <= count; i += 4)
+    {
+        __m128 lowX  = _mm_set1_ps(numeric_limits<float>::max());
+        __m128 lowY  = lowX;
+        __m128 lowZ  = lowX;
+        __m128 highX = _mm_set1_ps(-numeric_limits<float>::max());
+        __m128 highY = highX;
+
+        for (int k = 0; k < 3; k++)
+        {
+            const glm::vec3& a = faces[i]->vertices[faces[i]->indices[k]]->position;
+            const glm::vec3& b = faces[i + 1]->vertices[faces[i + 1]->indices[k]]->position;
+            const glm::vec3& c = faces[i + 2]->vertices[faces[i + 2]->indices[k]]->position;
+            const glm::vec3& d = faces[i + 3]->vertices[faces[i + 3]->indices[k]]->position;
+
+            __m128 px = _mm_setr_ps(a.x, b.x, c.x, d.x);
+            __m128 py = _mm_setr_ps(a.y, b.y, c.y, d.y);
+            __m128 pz = _mm_setr_ps(a.z, b.z, c.z, d.z);
+
+            // Columns are summed in pairs like glm does
+            __m128 cx = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(m[0][0]), px), _mm_mul_ps(_mm_set1_ps(m[1][0]), py)),
+                                   _mm_add_ps(_mm_mul_ps(_mm_set1_ps(m[2][0]), pz), _mm_set1_ps(m[3][0])));
+            __m128 cy = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(m[0][1]), px), _mm_mul_ps(_mm_set1_ps(m[1][1]), py)),
+                                   _mm_add_ps(_mm_mul_ps(_mm_set1_ps(m[2][1]), pz), _mm_set1_ps(m[3][1])));
+            __m128 cw = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(m[0][3]), px), _mm_mul_ps(_mm_set1_ps(m[1][3]), py)),
+                                   _mm_add_ps(_mm_mul_ps(_mm_set1_ps(m[2][3]), pz), _mm_set1_ps(m[3][3])));
+
+            __m128 sx = _mm_mul_ps(_mm_add_ps(_mm_div_ps(cx, cw), half), maxX);
+            __m128 sy = _mm_mul_ps(_mm_add_ps(_mm_div_ps(cy, cw), half), maxY);
+            __m128 sz = _mm_div_ps(one, cw);
+
+            lowX  = _mm_min_ps(lowX, sx);
+            lowY  = _mm_min_ps(lowY, sy);
+            lowZ  = _mm_min_ps(lowZ, sz);
+            highX = _mm_max_ps(highX, sx);
+            highY = _mm_max_ps(highY, sy);
+
+            float x[4];
+            float y[4];
+            float z[4];
+
+            _mm_storeu_ps(x, sx);
+            _mm_storeu_ps(y, sy);
+            _mm_storeu_ps(z, sz);
+
+            for (int lane = 0; lane < 4; lane++)
+            {
+                points[i + lane][k] = glm::vec3(x[lane], y[lane], z[lane]);
+            }
+        }
+
+        // Outcodes, clipping would drop every edge of a triangle past one bound
+        __m128 front = _mm_cmpgt_ps(lowZ, zero);
+        __m128 away  = _mm_or_ps(_mm_or_ps(_mm_cmplt_ps(highX, _mm_set1_ps(boundLeft)), _mm_cmpgt_ps(lowX, _mm_set1_ps(boundRight))),
+                                 _mm_or_ps(_mm_cmplt_ps(highY, _mm_set1_ps(boundBottom)), _mm_cmpgt_ps(lowY, _mm_set1_ps(boundTop))));
+        __m128 within = _mm_and_ps(_mm_and_ps(front, _mm_and_ps(_mm_cmpge_ps(lowX, zero), _mm_cmple_ps(highX, maxX))),
+                                   _mm_and_ps(_mm_cmpge_ps(lowY, zero), _mm_cmple_ps(highY, maxY)));
+
+        // Rows as the triangle setup takes them, a triangle inside the window
+        // within one row covers no line
+        __m128i top  = _mm_cvttps_epi32(highY);
+        __m128i bot  = _mm_cvttps_epi32(lowY);
+        __m128  flat = _mm_and_ps(within, _mm_castsi128_ps(_mm_cmpeq_epi32(top, bot)));
+
+        int tops[4];
+        int bots[4];
+
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(tops), top);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(bots), bot);
+
+        for (int lane = 0; lane < 4; lane++)
+        {
+            rows[i + lane] = glm::ivec2(tops[lane], bots[lane]);
+        }
+
+        keep   |= (~_mm_movemask_ps(_mm_or_ps(_mm_and_ps(front, away), flat)) & 0xf) << i;
+        inside |= _mm_movemask_ps(within) << i;
+    }
+#endif
+
+    for (; i < count; i++)
+    {
+        glm::vec3 low  = glm::vec3(numeric_limits<float>::max());
+        glm::vec3 high = -low;
+
+        for (int k = 0; k < 3; k++)
+        {
+            glm::vec4 point = m * glm::vec4(faces[i]->vertices[faces[i]->indices[k]]->position, 1.0f);
+            points[i][k] = glm::vec3((point.x / point.w + 0.5f) * scaleX, (point.y / point.w + 0.5f) * scaleY, 1 / point.w);
+
+            low  = glm::min(low, points[i][k]);
+            high = glm::max(high, points[i][k]);
+        }
+
+        bool front  = low.z > 0;
+        bool away   = (high.x < boundLeft) || (low.x > boundRight) || (high.y < boundBottom) || (low.y > boundTop);
+        bool within = front && (low.x >= 0) && (high.x <= scaleX) && (low.y >= 0) && (high.y <= scaleY);
+
+        rows[i] = glm::ivec2(static_cast<int>(high.y), static_cast<int>(low.y));
+
+        if (!(front && away) && !(within && (rows[i].x == rows[i].y)))
+        {
+            keep |= 1 << i;
+        }
+
+        if (within)
+        {
+            inside |= 1 << i;
+        }
+    }
+
+    // Compact the survivors, the setup below only sees those
+    int survivors[TRIANGLE_BATCH];
+    int kept = 0;
+
+    for (i = 0; i < count; i++)
+    {
+        if ((keep >> i) & 1)
+        {
+            survivors[kept++] = i;
+        }
+    }
+
+    for (int j = 0; j < kept; j++)
+    {
+        int t = survivors[j];
+
+        insertProjected(faces[t], geometry, useTexture, points[t], 3, ((inside >> t) & 1) ? &rows[t] : nullptr);
+    }
+}
+
+void ZBufferScanLine::insertProjected(Geometry::Face  * face,
+                                      GeometryResource* geometry,
+                                      bool              useTexture,
+                                      const glm::vec3 * projected,
+                                      int               count,
+                                      const glm::ivec2* rows)
+{
+    glm::ivec2 triangleRows;
+
+    // Triangles inside the window need neither clipping nor edge matching
+    if ((rows == nullptr) && (count == 3) && insideWindow(projected, count, width_, height_))
     {
-        windowTexCoord.reserve(face->indices.size());
+        triangleRows = glm::ivec2(static_cast<int>(std::max(std::max(projected[0].y, projected[1].y), projected[2].y)),
+                                  static_cast<int>(std::min(std::min(projected[0].y, projected[1].y), projected[2].y)));
+
+        // Within one row it covers no line
+        if (triangleRows.x == triangleRows.y)
+        {
+            return;
+        }
+
+        rows = &triangleRows;
+    }
 
-        for (int i = 0; i < face->indices.size(); i++)
+    // Save texture coordinates (storage is reused)
+    vector<glm::vec2>& windowTexCoord = windowTexCoord_;
+
+    windowTexCoord.clear();
+
+    if (useTexture)
+    {
+        for (size_t i = 0; i < face->indices.size(); i++)
         {
             windowTexCoord.push_back(face->vertices[face->indices[i]]->texCoord);
         }
     }
 
-    // Backface culling
+    // The screen test still drops edge-on and degenerate polygons (NaN normal)
     const glm::vec3& normal = computeNormal(projected[0], projected[1], projected[2]);
 
-    if (glm::dot(normal, glm::vec3(0, 0, 1)) < FLT_EPS)
+    if (!(glm::dot(normal, glm::vec3(0, 0, 1)) >= FLT_EPS))
     {
         return;
     }
@@ -570,16 +1754,66 @@ void ZBufferScanLine::insertPolygon(Geometry::Face* face, GeometryResource* geom
     int  top      = -1;
     int  bottom   = height_;
 
-    // New ZPolygon
-    ZPolygon* zPolygon = new ZPolygon;
+    // Polygons of triangles inside the window come from a pool instead of the heap
+    ZPolygon* zPolygon = rows != nullptr ? acquireTriangle() : new ZPolygon;
 
     // Calculate depth plane function
     zPolygon->depthPlane = computePlane(normal, projected[0]);
 
+    if (lighting_)
+    {
+        // Planes of world attributes / w through the first three vertices
+        const glm::vec3* p   = projected;
+        float            det = (p[1].x - p[0].x) * (p[2].y - p[0].y) - (p[2].x - p[0].x) * (p[1].y - p[0].y);
+        glm::vec3        positions[3];
+        glm::vec3        normals[3];
+
+        for (int i = 0; i < 3; i++)
+        {
+            positions[i] = face->vertices[face->indices[i]]->position;
+            normals[i]   = face->vertices[face->indices[i]]->normal;
+        }
+
+        // Flat shading for meshes without normals
+        if ((normals[0] == glm::vec3(0.0f)) || (normals[1] == glm::vec3(0.0f)) || (normals[2] == glm::vec3(0.0f)))
+        {
+            normals[0] = normals[1] = normals[2] = glm::normalize(glm::vec3(face->plane));
+        }
+
+        for (int i = 0; i < 3; i++)
+        {
+            positions[i] = glm::vec3(model_ * glm::vec4(positions[i], 1.0f)) * p[i].z;
+            normals[i]   = normalMatrix_ * normals[i] * p[i].z;
+        }
+
+        for (int k = 0; k < 3; k++)
+        {
+            zPolygon->normalPlanes[k]   = computeScreenPlane(p, normals[0][k], normals[1][k], normals[2][k], det);
+            zPolygon->positionPlanes[k] = computeScreenPlane(p, positions[0][k], positions[1][k], positions[2][k], det);
+        }
+    }
+
+    zPolygon->color = packPixel(face->vertices[face->indices[0]]->color);
+
+    if (useTexture)
+    {
+        zPolygon->textures = &geometry->textures;
+    }
+
+    selectKernel(*zPolygon);
+
+    if (rows != nullptr)
+    {
+        setupTriangle(*zPolygon, projected, *rows, windowTexCoord, useTexture);
+        numPolygon_++;
+
+        return;
+    }
+
     // Process edges
-    for (int i = 0; i < projected.size(); i++)
+    for (int i = 0; i < count; i++)
     {
-        int  next = i == projected.size() - 1 ? 0 : i + 1;
+        int  next = i == count - 1 ? 0 : i + 1;
         auto p1   = projected[i];
         auto p2   = projected[next];
         glm::vec2 tex1;
@@ -665,15 +1899,9 @@ void ZBufferScanLine::insertPolygon(Geometry::Face* face, GeometryResource* geom
     }
 
     // Insert polygon
-    colorCpy(zPolygon->color, face->vertices[face->indices[0]]->color, true);
     zPolygon->dy = top - bottom + 1;
 
-    if (useTexture)
-    {
-        zPolygon->textures = &geometry->textures;
-    }
-
-    polygonTables_[top].push_back(zPolygon);
+    polygonBuckets_.add(top, zPolygon);
     numPolygon_++;
 }
 